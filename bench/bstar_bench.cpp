@@ -0,0 +1,278 @@
+// Throughput and tail latency of utec::memory::bstar and utec::disk::bstar.
+//
+//   bstar-bench [--keys N] [--out results.jsonl] [--dir /path/for/index/files]
+//
+// Every (tree, order, distribution) combination runs insert, search,
+// scan and remove phases; disk searches run once with a cold and once
+// with a warm page cache. Each phase prints one JSON object per line.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <utec/disk/bstar.h>
+#include <utec/memory/bstar.h>
+
+namespace {
+
+    typedef std::chrono::steady_clock clock_type;
+
+    uint64_t splitmix(uint64_t x) {
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    // Zipfian ranks after Gray et al., "Quickly generating billion-record
+    // synthetic databases", scrambled so hot keys are spread over the range.
+    class zipfian {
+    public:
+        zipfian(uint64_t n, double theta = 0.99) : n(n), theta(theta) {
+            zetan = zeta(n);
+            alpha = 1 / (1 - theta);
+            eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta(2) / zetan);
+        }
+
+        uint64_t operator()(uint64_t i) const {
+            double u = (splitmix(i) >> 11) * (1.0 / 9007199254740992.0);
+            double uz = u * zetan;
+            uint64_t rank;
+            if (uz < 1) rank = 0;
+            else if (uz < 1 + std::pow(0.5, theta)) rank = 1;
+            else rank = uint64_t(n * std::pow(eta * u - eta + 1, alpha));
+            return rank;
+        }
+
+    private:
+        uint64_t n;
+        double theta, zetan, alpha, eta;
+
+        double zeta(uint64_t m) const {
+            double sum = 0;
+            for (uint64_t i = 1; i <= m; i++) sum += 1 / std::pow(double(i), theta);
+            return sum;
+        }
+    };
+
+    enum distribution { SEQUENTIAL, UNIFORM, ZIPFIAN };
+
+    const char *distribution_name(distribution d) {
+        static const char *names[] = {"sequential", "uniform", "zipfian"};
+        return names[d];
+    }
+
+    // Keys are generated from their index so that data sets larger than
+    // memory never need to be materialised.
+    class keygen {
+    public:
+        keygen(distribution d, uint64_t n) : d(d), n(n), zipf(d == ZIPFIAN ? n : 2) {}
+
+        long operator()(uint64_t i) const {
+            switch (d) {
+                case SEQUENTIAL: return i;
+                case UNIFORM: return splitmix(i) % (4 * n);
+                default: return splitmix(zipf(i)) % (4 * n);
+            }
+        }
+
+    private:
+        distribution d;
+        uint64_t n;
+        zipfian zipf;
+    };
+
+    struct result {
+        std::string tree, workload, cache;
+        int order;
+        long page_size;
+        distribution dist;
+        uint64_t keys, ops;
+        double seconds;
+        std::vector<uint64_t> latency;
+        uint64_t pages_read, pages_written;
+    };
+
+    uint64_t percentile(std::vector<uint64_t> &v, double q) {
+        if (v.empty()) return 0;
+        std::size_t k = std::min(v.size() - 1, std::size_t(q * v.size()));
+        std::nth_element(v.begin(), v.begin() + k, v.end());
+        return v[k];
+    }
+
+    void emit(std::ostream &out, result &r) {
+        out << "{\"tree\":\"" << r.tree << "\""
+            << ",\"order\":" << r.order
+            << ",\"page_size\":" << r.page_size
+            << ",\"distribution\":\"" << distribution_name(r.dist) << "\""
+            << ",\"keys\":" << r.keys
+            << ",\"workload\":\"" << r.workload << "\""
+            << ",\"cache\":\"" << r.cache << "\""
+            << ",\"ops\":" << r.ops
+            << ",\"seconds\":" << r.seconds
+            << ",\"ops_per_sec\":" << (r.seconds > 0 ? r.ops / r.seconds : 0)
+            << ",\"p50_ns\":" << percentile(r.latency, 0.5)
+            << ",\"p99_ns\":" << percentile(r.latency, 0.99)
+            << ",\"p999_ns\":" << percentile(r.latency, 0.999)
+            << ",\"pages_read\":" << r.pages_read
+            << ",\"pages_written\":" << r.pages_written
+            << "}" << std::endl;
+    }
+
+    // Runs `op(i)` for i in [0, n), timing every call.
+    template <class Op>
+    void measure(result &r, uint64_t n, Op op) {
+        r.ops = n;
+        r.latency.clear();
+        r.latency.reserve(n);
+        auto start = clock_type::now();
+        for (uint64_t i = 0; i < n; i++) {
+            auto t0 = clock_type::now();
+            op(i);
+            r.latency.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                clock_type::now() - t0).count());
+        }
+        r.seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    }
+
+    void drop_cache(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        fdatasync(fd);
+#ifdef POSIX_FADV_DONTNEED
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+        ::close(fd);
+    }
+
+    struct options {
+        uint64_t keys = 100000;
+        std::string dir = ".";
+    };
+
+    template <int ORDER>
+    void run_disk(const options &opt, distribution d, std::ostream &out) {
+        using namespace utec::disk;
+        typedef bstar<long, ORDER> tree_type;
+
+        std::string path = opt.dir + "/bstar-bench-" + std::to_string(ORDER) + ".index";
+        auto pm = std::make_shared<pagemanager>(path, true);
+        tree_type tree(pm);
+        keygen key(d, opt.keys);
+
+        result r;
+        r.tree = "disk";
+        r.order = ORDER;
+        r.page_size = sizeof(utec::disk::Node<long, ORDER>);
+        r.dist = d;
+        r.keys = opt.keys;
+
+        auto phase = [&](const char *workload, const char *cache) {
+            r.workload = workload;
+            r.cache = cache;
+            statistics::snapshot s = tree.stats().snap();
+            r.pages_read = s.counters[statistics::PAGES_READ];
+            r.pages_written = s.counters[statistics::PAGES_WRITTEN];
+            emit(out, r);
+            tree.stats().reset();
+        };
+
+        tree.stats().reset();
+        measure(r, opt.keys, [&](uint64_t i) { tree.insert(key(i)); });
+        phase("insert", "warm");
+
+        drop_cache(path);
+        measure(r, opt.keys, [&](uint64_t i) { tree.find(key(i)); });
+        phase("search", "cold");
+
+        measure(r, opt.keys, [&](uint64_t i) { tree.find(key(i)); });
+        phase("search", "warm");
+
+        drop_cache(path);
+        uint64_t scanned = 0;
+        auto start = clock_type::now();
+        for (auto it = tree.begin(); it != tree.end(); ++it) scanned++;
+        r.seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+        r.ops = scanned;
+        r.latency.clear();
+        phase("scan", "cold");
+
+        measure(r, opt.keys / 2, [&](uint64_t i) { tree.remove(key(i)); });
+        phase("remove", "warm");
+
+        pm.reset();
+        ::unlink(path.c_str());
+    }
+
+    template <int ORDER>
+    void run_memory(const options &opt, distribution d, std::ostream &out) {
+        utec::memory::bstar<long, ORDER> tree;
+        keygen key(d, opt.keys);
+
+        result r;
+        r.tree = "memory";
+        r.order = ORDER;
+        r.page_size = 0;
+        r.dist = d;
+        r.keys = opt.keys;
+        r.cache = "warm";
+        r.pages_read = r.pages_written = 0;
+
+        measure(r, opt.keys, [&](uint64_t i) { tree.insert(key(i)); });
+        r.workload = "insert";
+        emit(out, r);
+
+        measure(r, opt.keys, [&](uint64_t i) { tree.search(key(i)); });
+        r.workload = "search";
+        emit(out, r);
+
+        measure(r, opt.keys / 2, [&](uint64_t i) { tree.remove(key(i)); });
+        r.workload = "remove";
+        emit(out, r);
+    }
+
+    template <int ORDER>
+    void run_all(const options &opt, std::ostream &out) {
+        for (int d = SEQUENTIAL; d <= ZIPFIAN; d++) {
+            run_memory<ORDER>(opt, distribution(d), out);
+            run_disk<ORDER>(opt, distribution(d), out);
+        }
+    }
+
+} // namespace
+
+int main(int argc, char **argv) {
+    options opt;
+    std::string out_path;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--keys") opt.keys = std::strtoull(argv[i + 1], 0, 10);
+        else if (arg == "--out") out_path = argv[i + 1];
+        else if (arg == "--dir") opt.dir = argv[i + 1];
+        else {
+            std::cerr << "usage: " << argv[0] << " [--keys N] [--out file] [--dir path]\n";
+            return 1;
+        }
+    }
+
+    std::ofstream file;
+    if (!out_path.empty()) file.open(out_path.c_str());
+    std::ostream &out = out_path.empty() ? std::cout : file;
+
+    run_all<7>(opt, out);
+    run_all<31>(opt, out);
+    run_all<127>(opt, out);
+    run_all<255>(opt, out);
+    return 0;
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+#include "crc32c.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace utec {
+
+    namespace disk {
+
+        // Binary stream of sorted keys, as written by bstar::export_keys()
+        // and read by bstar::import_keys(). A file header is followed by
+        // blocks of `block_size` bytes:
+        //
+        //   block header: key count, payload bytes used, CRC-32C of both
+        //                 and of the payload;
+        //   payload:      the keys as raw bytes, or with `delta` set (only
+        //                 for integral keys) the first key raw and each
+        //                 following one as a zigzag LEB128 varint of its
+        //                 difference to the previous key.
+        //
+        // Every block decodes on its own. Readers and writers hold a batch
+        // of whole blocks (about 1 MB) at a time, whatever the key count.
+        struct blockstream_header {
+            char magic[8];
+            uint32_t version;
+            uint32_t key_size;
+            uint32_t block_size;
+            uint32_t delta;
+            int64_t count;
+            uint32_t checksum;
+            uint32_t reserved;
+        };
+
+        struct blockstream_block {
+            uint32_t count;
+            uint32_t used;
+            uint32_t checksum;
+            uint32_t reserved;
+        };
+
+        enum blockstream_limits {
+            BLOCKSTREAM_VERSION = 1,
+            BLOCKSTREAM_BATCH = 1 << 20,
+            BLOCKSTREAM_MIN_BLOCK = 256,
+        };
+
+        template <class T>
+        class blockcodec {
+        protected:
+            static_assert(std::is_trivially_copyable<T>::value, "block streams need trivially copyable keys");
+
+            static bool can_delta() { return std::is_integral<T>::value; }
+
+            static uint64_t bits(const T &key, std::true_type) { return (uint64_t) (int64_t) key; }
+            static uint64_t bits(const T &, std::false_type) { return 0; }
+            static T from_bits(uint64_t v, std::true_type) { return (T) v; }
+            static T from_bits(uint64_t, std::false_type) { return T(); }
+
+            static uint64_t bits(const T &key) { return bits(key, std::is_integral<T>()); }
+            static T from_bits(uint64_t v) { return from_bits(v, std::is_integral<T>()); }
+
+            static uint32_t seal(const blockstream_block &b, const unsigned char *payload) {
+                uint32_t crc = crc32c::extend(0, &b.count, sizeof(b.count));
+                crc = crc32c::extend(crc, &b.used, sizeof(b.used));
+                return crc32c::extend(crc, payload, b.used);
+            }
+
+            static uint32_t seal(blockstream_header h) {
+                h.checksum = 0;
+                return crc32c::of(&h, sizeof(h));
+            }
+        };
+
+        template <class T>
+        class blockwriter : blockcodec<T> {
+            typedef blockcodec<T> codec;
+
+        public:
+            // Writes to `path` + ".tmp" and renames it over `path` in finish().
+            blockwriter(const std::string &path, bool delta, std::size_t block_size) :
+                path(path), tmp(path + ".tmp"), block_size(block_size), delta(delta && codec::can_delta()) {
+                if (block_size < BLOCKSTREAM_MIN_BLOCK || block_size < sizeof(blockstream_block) + 2 * sizeof(T)) {
+                    throw std::invalid_argument("block size " + std::to_string(block_size) + " is too small");
+                }
+                fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd < 0) throw std::runtime_error("cannot create " + tmp);
+                buffer.assign(std::max<std::size_t>(1, BLOCKSTREAM_BATCH / block_size) * block_size, 0);
+                std::memset(&header, 0, sizeof(header));
+                std::memcpy(header.magic, "UTECBSX", 8);
+                header.version = BLOCKSTREAM_VERSION;
+                header.key_size = sizeof(T);
+                header.block_size = block_size;
+                header.delta = this->delta;
+                written = sizeof(header);
+                start_block();
+            }
+
+            ~blockwriter() {
+                if (fd >= 0) {
+                    ::close(fd);
+                    ::unlink(tmp.c_str());
+                }
+            }
+
+            void add(const T &key) {
+                if (!fits(key)) {
+                    close_block();
+                    start_block();
+                }
+                unsigned char *p = payload() + block.used;
+                if (!delta || !block.count) {
+                    std::memcpy(p, &key, sizeof(T));
+                    block.used += sizeof(T);
+                } else {
+                    uint64_t d = codec::bits(key) - codec::bits(last);
+                    uint64_t z = (d << 1) ^ (uint64_t) ((int64_t) d >> 63);
+                    while (z >= 0x80) {
+                        *p++ = (unsigned char) (z | 0x80);
+                        z >>= 7;
+                        block.used++;
+                    }
+                    *p = (unsigned char) z;
+                    block.used++;
+                }
+                block.count++;
+                header.count++;
+                last = key;
+            }
+
+            // Writes the last block and the header; returns the key count.
+            long finish() {
+                if (block.count) close_block();
+                flush();
+                header.checksum = codec::seal(header);
+                if (::pwrite(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) || ::fsync(fd) != 0) {
+                    throw std::runtime_error("cannot write " + tmp);
+                }
+                ::close(fd);
+                fd = -1;
+                if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+                    ::unlink(tmp.c_str());
+                    throw std::runtime_error("cannot rename " + tmp + " to " + path);
+                }
+                return header.count;
+            }
+
+        private:
+            std::string path, tmp;
+            std::size_t block_size;
+            bool delta;
+            int fd;
+            blockstream_header header;
+            blockstream_block block;
+            std::vector<unsigned char> buffer;
+            std::size_t filled = 0;  // bytes of whole blocks in `buffer`
+            long written;            // file offset of buffer[0]
+            T last;
+
+            unsigned char *payload() { return buffer.data() + filled + sizeof(blockstream_block); }
+
+            bool fits(const T &) const {
+                std::size_t room = block_size - sizeof(blockstream_block) - block.used;
+                return room >= (delta && block.count ? 10 : sizeof(T));
+            }
+
+            void start_block() {
+                std::memset(&block, 0, sizeof(block));
+                std::memset(buffer.data() + filled, 0, block_size);
+            }
+
+            void close_block() {
+                block.checksum = codec::seal(block, payload());
+                std::memcpy(buffer.data() + filled, &block, sizeof(block));
+                filled += block_size;
+                if (filled == buffer.size()) flush();
+            }
+
+            void flush() {
+                const unsigned char *p = buffer.data();
+                std::size_t left = filled;
+                while (left) {
+                    ssize_t w = ::pwrite(fd, p, left, written);
+                    if (w <= 0) throw std::runtime_error("cannot write " + tmp);
+                    p += w;
+                    left -= w;
+                    written += w;
+                }
+                filled = 0;
+            }
+        };
+
+        template <class T>
+        class blockreader : blockcodec<T> {
+            typedef blockcodec<T> codec;
+
+        public:
+            blockreader(const std::string &path) : path(path) {
+                fd = ::open(path.c_str(), O_RDONLY);
+                if (fd < 0) throw std::runtime_error("cannot open " + path);
+#ifdef POSIX_FADV_SEQUENTIAL
+                posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+                if (::pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+                    std::memcmp(header.magic, "UTECBSX", 8) != 0) {
+                    ::close(fd);
+                    throw std::runtime_error(path + " is not a block stream");
+                }
+                if (header.checksum != codec::seal(header) || header.version != BLOCKSTREAM_VERSION ||
+                    header.key_size != sizeof(T) || header.block_size < BLOCKSTREAM_MIN_BLOCK ||
+                    (header.delta && !codec::can_delta()) || header.count < 0) {
+                    ::close(fd);
+                    throw std::runtime_error(path + " has a bad or incompatible block stream header");
+                }
+                offset = sizeof(header);
+                buffer.resize(std::max<std::size_t>(1, BLOCKSTREAM_BATCH / header.block_size) * header.block_size);
+            }
+
+            ~blockreader() { ::close(fd); }
+
+            long count() const { return header.count; }
+
+            bool next(T &out) {
+                if (left == 0) {
+                    if (seen == header.count) return false;
+                    load_block();
+                }
+                if (!header.delta || first) {
+                    if (p + sizeof(T) > end) corrupt();
+                    std::memcpy(&out, p, sizeof(T));
+                    p += sizeof(T);
+                    first = false;
+                } else {
+                    uint64_t z = 0;
+                    for (int shift = 0;; shift += 7) {
+                        if (p == end || shift > 63) corrupt();
+                        z |= (uint64_t) (*p & 0x7f) << shift;
+                        if (!(*p++ & 0x80)) break;
+                    }
+                    uint64_t d = (z >> 1) ^ (0 - (z & 1));
+                    out = codec::from_bits(codec::bits(last) + d);
+                }
+                last = out;
+                left--;
+                seen++;
+                return true;
+            }
+
+        private:
+            std::string path;
+            int fd;
+            blockstream_header header;
+            std::vector<unsigned char> buffer;
+            std::size_t pos = 0, filled = 0;
+            long offset;
+            long seen = 0;
+            uint32_t left = 0;
+            bool first = false;
+            const unsigned char *p = nullptr, *end = nullptr;
+            T last;
+
+            [[noreturn]] void corrupt() { throw std::runtime_error("corrupt block in " + path); }
+
+            void load_block() {
+                if (pos == filled) {
+                    ssize_t got = ::pread(fd, buffer.data(), buffer.size(), offset);
+                    if (got < (ssize_t) header.block_size) throw std::runtime_error("truncated block stream " + path);
+                    offset += got;
+                    filled = got - got % header.block_size;
+                    offset -= got % header.block_size;
+                    pos = 0;
+                }
+                blockstream_block b;
+                const unsigned char *data = buffer.data() + pos;
+                std::memcpy(&b, data, sizeof(b));
+                pos += header.block_size;
+                if (!b.count || b.used > header.block_size - sizeof(b) ||
+                    b.checksum != codec::seal(b, data + sizeof(b))) {
+                    corrupt();
+                }
+                left = b.count;
+                first = true;
+                p = data + sizeof(b);
+                end = p + b.used;
+            }
+        };
+
+    } // namespace disk
+
+} // namespace utec
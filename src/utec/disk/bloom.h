@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace utec {
+
+    namespace disk {
+
+        // 64-bit hash of a key for the Bloom filter. The default hashes the
+        // object bytes, which is right for integers and padding-free PODs;
+        // key types whose equality ignores part of their bytes specialise it.
+        template <class T>
+        struct bloomhash {
+            uint64_t operator()(const T &key) const {
+                const unsigned char *p = reinterpret_cast<const unsigned char *>(&key);
+                uint64_t h = 0xcbf29ce484222325ull;
+                for (std::size_t i = 0; i < sizeof(T); i++) {
+                    h = (h ^ p[i]) * 0x100000001b3ull;
+                }
+                h ^= h >> 33;
+                h *= 0xff51afd7ed558ccdull;
+                h ^= h >> 33;
+                h *= 0xc4ceb9fe1a85ec53ull;
+                return h ^ (h >> 33);
+            }
+        };
+
+        // Key equality matching bloomhash: object bytes by default, and
+        // specialised together with it.
+        template <class T>
+        struct bloomequal {
+            bool operator()(const T &a, const T &b) const { return std::memcmp(&a, &b, sizeof(T)) == 0; }
+        };
+
+        // Blocked Bloom filter: every key sets all of its bits inside one
+        // cache-line sized block, so a query touches a single cache line.
+        class bloomfilter {
+        public:
+            enum {
+                BLOCK_BYTES = 64,
+                BLOCK_WORDS = BLOCK_BYTES / 8,
+                BLOCK_BITS = BLOCK_BYTES * 8,
+            };
+
+            bloomfilter() {}
+
+            // Sized for `expected` keys at `bits_per_key` bits each.
+            bloomfilter(long expected, int bits_per_key) : bits_per_key(bits_per_key) {
+                long bits = std::max(expected, 1L) * bits_per_key;
+                long blocks = (bits + BLOCK_BITS - 1) / BLOCK_BITS;
+                words.assign(blocks * BLOCK_WORDS, 0);
+                // ln 2 * bits per key, rounded, is the optimal probe count.
+                probes = std::max(1, std::min(16, (bits_per_key * 69 + 50) / 100));
+            }
+
+            void add(uint64_t h) {
+                uint64_t *block = &words[block_of(h) * BLOCK_WORDS];
+                uint32_t h1 = h, h2 = second(h);
+                for (int i = 0; i < probes; i++, h1 += h2) {
+                    block[(h1 % BLOCK_BITS) / 64] |= uint64_t(1) << (h1 % 64);
+                }
+                keys++;
+            }
+
+            bool may_contain(uint64_t h) const {
+                const uint64_t *block = &words[block_of(h) * BLOCK_WORDS];
+                uint32_t h1 = h, h2 = second(h);
+                for (int i = 0; i < probes; i++, h1 += h2) {
+                    if (!(block[(h1 % BLOCK_BITS) / 64] & (uint64_t(1) << (h1 % 64)))) return false;
+                }
+                return true;
+            }
+
+            bool empty() const { return words.empty(); }
+
+            // Keys the filter was sized for before its false-positive rate
+            // climbs above the target.
+            long capacity() const {
+                return bits_per_key ? (long) words.size() * 64 / bits_per_key : 0;
+            }
+
+            long size() const { return keys; }
+
+            std::vector<char> serialize() const {
+                image head{(long) words.size() / BLOCK_WORDS, probes, bits_per_key, keys};
+                std::vector<char> out(sizeof(head) + words.size() * 8);
+                std::memcpy(out.data(), &head, sizeof(head));
+                std::memcpy(out.data() + sizeof(head), words.data(), words.size() * 8);
+                return out;
+            }
+
+            bool deserialize(const std::vector<char> &in) {
+                image head;
+                if (in.size() < sizeof(head)) return false;
+                std::memcpy(&head, in.data(), sizeof(head));
+                if (head.blocks <= 0 || in.size() < sizeof(head) + head.blocks * BLOCK_BYTES) return false;
+                words.resize(head.blocks * BLOCK_WORDS);
+                std::memcpy(words.data(), in.data() + sizeof(head), words.size() * 8);
+                probes = (int) head.probes;
+                bits_per_key = (int) head.bits_per_key;
+                keys = head.keys;
+                return true;
+            }
+
+        private:
+            struct image {
+                long blocks;
+                long probes;
+                long bits_per_key;
+                long keys;
+            };
+
+            std::vector<uint64_t> words;
+            int probes = 0;
+            int bits_per_key = 0;
+            long keys = 0;
+
+            static uint32_t second(uint64_t h) {
+                return uint32_t((h * 0x9e3779b97f4a7c15ull) >> 32) | 1;
+            }
+
+            std::size_t block_of(uint64_t h) const {
+                // Multiply-shift maps the high bits onto [0, blocks).
+                uint64_t blocks = words.size() / BLOCK_WORDS;
+                return (std::size_t) (((h >> 32) * blocks) >> 32);
+            }
+        };
+
+    } // namespace disk
+
+} // namespace utec
@@ -1,28 +1,48 @@
 #pragma once
 
+#include "../keys.h"
+#include "blockstream.h"
+#include "bloom.h"
+#include "catalog.h"
+#include "crc32c.h"
 #include "pagemanager.h"
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iterator>
 #include <memory>
 #include <stack>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace utec {
 
     namespace disk {
 
-        template <class T, int BSTAR_ORDER>
+        template <class T, int BSTAR_ORDER, bool COUNTED, class Compare>
         class bstar;
 
-        template <class T, int BSTAR_ORDER>
+        template <class T, int BSTAR_ORDER, bool COUNTED>
         class Node;
 
-        template <class T, int BSTAR_ORDER = 3>
+        template <class T, int BSTAR_ORDER = 3, bool COUNTED = false, class Compare = utec::less>
         class bstariterator {
         private:
             template <int SIZE = BSTAR_ORDER>
-            using Node = utec::disk::Node<T, SIZE>;
+            using Node = utec::disk::Node<T, SIZE, COUNTED>;
 
             enum blocksize {
                 F_BLOCK = (2*BSTAR_ORDER-2)/3,
+                READ_AHEAD = 4,
             };
           
             std::shared_ptr<pagemanager> pm;
@@ -31,19 +51,85 @@ namespace utec {
 
             int index;
             long node_id;
+            long root_id;
+            Compare comp;
+            bool detached = false;  // placed without the path above its page
+
+            bool same(const T &a, const T &b) const { return !comp(a, b) && !comp(b, a); }
+
+            // Rebuilds the path of a placed iterator before it moves.
+            void attach() {
+                if(!detached) return;
+                detached = false;
+                T key = **this;
+                q = std::stack<std::pair<long,int>>();
+                find(key);
+            }
+
+            // Lower-bound descent from `n`, stacking the keys left pending
+            // above the path; falls back on the stack past the subtree.
+            template <int SIZE>
+            void descend(Node<SIZE> &n, const T &key) {
+                int lb = std::lower_bound(n.keys, n.keys + n.count, key, comp) - n.keys;
+                if(n.children[lb]){
+                    if(lb < n.count) q.push({n.page_id, lb});
+                    Node<> child = read_node(n.children[lb]);
+                    descend(child, key);
+                } else if(lb < n.count){
+                    node_id = n.page_id;
+                    index = lb;
+                } else if(q.empty()){
+                    node_id = -1;
+                    index = 0;
+                } else {
+                    node_id = q.top().first;
+                    index = q.top().second;
+                    q.pop();
+                }
+            }
+
+            // True if the current key, or a later one of the current leaf,
+            // is the target.
+            template <int SIZE>
+            bool within(Node<SIZE> &n, const T &key) {
+                if(!comp(n.keys[index], key)) return true;
+                if(n.children[0] || comp(n.keys[n.count-1], key)) return false;
+                index = std::lower_bound(n.keys + index, n.keys + n.count, key, comp) - n.keys;
+                return true;
+            }
+
+            // Searches the rest of child `idx` of `n` if its pending key
+            // keys[idx] bounds the target.
+            template <int SIZE>
+            bool resume(Node<SIZE> &n, int idx, const T &key) {
+                if(comp(n.keys[idx], key)) return false;
+                Node<> child = read_node(n.children[idx]);
+                descend(child, key);
+                return true;
+            }
         public:
-            bstariterator(std::shared_ptr<pagemanager> &pm) : 
-                pm(pm), node_id(-1), index(0){}
+            bstariterator(std::shared_ptr<pagemanager> &pm, long root_id = 1, const Compare &comp = Compare()) : 
+                pm(pm), node_id(-1), index(0), root_id(root_id), comp(comp) {}
 
-            bstariterator(std::shared_ptr<pagemanager> &pm, long node_id) : 
-                pm(pm), node_id(node_id), index(0) {
-                
+            bstariterator(std::shared_ptr<pagemanager> &pm, const bstariterator& other): 
+                pm(pm), node_id(other.node_id), index(other.index), q(other.q), root_id(other.root_id), comp(other.comp),
+                detached(other.detached) {}
+
+            // Positions the iterator on the smallest key.
+            void first() {
                 Node<2*F_BLOCK> n = read_root();
+                if(!n.count){
+                    this->node_id = -1;
+                    this->index = 0;
+                    return;
+                }
                 if(n.children[0]){
                     this->q.push({n.page_id,0});
+                    read_ahead(n, 1);
                     Node<> nn = read_node(n.children[0]);
                     while(nn.children[0]){
                         this->q.push({nn.page_id,0});
+                        read_ahead(nn, 1);
                         nn = read_node(nn.children[0]);
                     }
                     this->node_id = nn.page_id;
@@ -51,20 +137,16 @@ namespace utec {
                     this->node_id = n.page_id;
                 }
                 this->index = 0;
-            
             }
-         
-            bstariterator(std::shared_ptr<pagemanager> &pm, const bstariterator& other): 
-                pm(pm), node_id(other.node_id), index(other.index), q(other.q) {}
 
             void find(const T &key) {
                 Node<2*F_BLOCK> n = read_root();
                 int lb = 0;
-                while (lb < n.count && n.keys[lb] < key) {
+                while (lb < n.count && comp(n.keys[lb], key)) {
                     lb++;
                 }
 
-                if(n.keys[lb] == key){
+                if(lb < n.count && same(n.keys[lb], key)){
                     node_id = n.page_id;
                     index = lb;
                     return;
@@ -80,11 +162,11 @@ namespace utec {
 
                 Node<> nn = read_node(n.children[lb]);
                 lb = 0;
-                while (lb < nn.count && nn.keys[lb] < key) {
+                while (lb < nn.count && comp(nn.keys[lb], key)) {
                     lb++;
                 }
 
-                if(nn.keys[lb] == key){
+                if(lb < nn.count && same(nn.keys[lb], key)){
                     node_id = nn.page_id;
                     index = lb;
                     return;
@@ -94,13 +176,13 @@ namespace utec {
                     if(lb < nn.count) q.push({nn.page_id, lb});
                     nn = read_node(nn.children[lb]);
                     lb = 0; 
-                    while (lb < nn.count && nn.keys[lb] < key) {
+                    while (lb < nn.count && comp(nn.keys[lb], key)) {
                         lb++;
                     }
-                    if(nn.keys[lb] == key) break;
+                    if(lb < nn.count && same(nn.keys[lb], key)) break;
                 }
 
-                if(nn.keys[lb] != key){
+                if(lb == nn.count || !same(nn.keys[lb], key)){
                     node_id = -1;
                     index = 0;
                     q.empty();
@@ -110,56 +192,115 @@ namespace utec {
                 }
             }
 
+            // Positions the iterator on slot `slot` of page `page_id`, found
+            // without a descent; the path is read if it is ever advanced.
+            void place(long page_id, int slot) {
+                q = std::stack<std::pair<long,int>>();
+                node_id = page_id;
+                index = slot;
+                detached = true;
+            }
+
+            long page() const { return node_id; }
+
+            // Positions the iterator on the first key not below `key`.
+            void seek(const T &key) {
+                q = std::stack<std::pair<long,int>>();
+                detached = false;
+                Node<2*F_BLOCK> n = read_root();
+                descend(n, key);
+            }
+
+            // Moves forward to the first key not below `key`; never moves
+            // back. Only the subtree between the current key and the nearest
+            // pending ancestor key not below `key` is searched again, so a
+            // short hop stays in the current leaf and a long one reads a
+            // single path instead of every page in between.
+            void advance_to(const T &key) {
+                if(node_id == -1) return;
+                attach();
+                bool done;
+                if(node_id == root_id){
+                    Node<2*F_BLOCK> n = read_root();
+                    done = within(n, key);
+                } else {
+                    Node<> n = read_node(node_id);
+                    done = within(n, key);
+                }
+                if(done) return;
+                while(!q.empty()){
+                    std::pair<long,int> top = q.top();
+                    if(top.first == root_id){
+                        Node<2*F_BLOCK> n = read_root();
+                        if(resume(n, top.second, key)) return;
+                    } else {
+                        Node<> n = read_node(top.first);
+                        if(resume(n, top.second, key)) return;
+                    }
+                    q.pop();
+                }
+                seek(key);
+            }
+
             Node<> read_node(long page_id) {
                 Node<> n{-1};
                 pm->recover(page_id, n);
+                n.check(page_id);
                 return n;
             }
 
             Node<2*F_BLOCK> read_root() {
                 Node<2*F_BLOCK> n{-1};
-                pm->recover(1, n);
+                pm->recover(root_id, n);
+                n.check(root_id);
                 return n;
             }
-          
-            bstariterator& operator=(bstariterator other) { 
-                this->node_id = other.node_id;
-                this->index = other.index;
-                return *this;
+
+            // Asks for the next few siblings while the current one is scanned.
+            template <int SIZE>
+            void read_ahead(Node<SIZE> &parent, int from) {
+                for(int i=from; i<=parent.count && i<from+READ_AHEAD; i++){
+                    if(parent.children[i]) pm->prefetch<Node<>>(parent.children[i]);
+                }
             }
 
             bstariterator& operator++() {
+                attach();
                 Node<> n;
                 Node<2*F_BLOCK> r;
-                if(this->node_id == 1){
+                if(this->node_id == root_id){
                     r = read_root();
                 } else {
                     n = read_node(this->node_id);
                 }
-                if ((this->node_id != 1 && n.children[index+1])
-                    || (this->node_id == 1 && r.children[index+1])) {
+                if ((this->node_id != root_id && n.children[index+1])
+                    || (this->node_id == root_id && r.children[index+1])) {
 
-                    if(this->node_id != 1 && index+1 < n.count
-                        || this->node_id == 1 && index+1 < r.count){
+                    if(this->node_id != root_id && index+1 < n.count
+                        || this->node_id == root_id && index+1 < r.count){
                         q.push({node_id,index+1});
                     }
 
                     long id;
                     Node<> nn;
-                    if(this->node_id != 1)
+                    if(this->node_id != root_id){
+                        read_ahead(n, index+2);
                         nn = read_node(n.children[++index]);
-                    else 
+                    } else {
+                        read_ahead(r, index+2);
                         nn = read_node(r.children[++index]);
+                    }
                     while(nn.children[0]){
                         q.push({nn.page_id,0});
+                        read_ahead(nn, 1);
                         id = nn.children[0];
                         nn = read_node(id);
                     }
 
                     this->node_id = nn.page_id;
                     this->index = 0;
-                } else if ((this->node_id != 1 && !(index < n.count-1))
-                    || (this->node_id == 1 && !(index < r.count-1))) {
+                } else if ((this->node_id != root_id && !(index < n.count-1))
+                    || (this->node_id == root_id && !(index < r.count-1))) {
                     if(q.empty()){
                         node_id = -1;
                         index = 0;
@@ -190,7 +331,7 @@ namespace utec {
             } 
 
             T operator*() { 
-                if(this->node_id == 1){
+                if(this->node_id == root_id){
                     Node<2*F_BLOCK> n = read_root();
                     return n.keys[index]; 
                 } else {
@@ -200,7 +341,7 @@ namespace utec {
             }
 
             long get_page_id() {
-                if(this->node_id == 1){
+                if(this->node_id == root_id){
                     Node<2*F_BLOCK> n = read_root();
                     return n.children[index]; 
                 } else {
@@ -211,12 +352,32 @@ namespace utec {
         };
 
 
-        template <class T, int BSTAR_ORDER = 3>
-        class Node {
+        // Number of keys below each child, stored only by trees built with
+        // COUNTED; the empty specialisation keeps the page layout unchanged.
+        template <int SIZE, bool COUNTED>
+        struct subtreesizes {
+            long sizes[SIZE + 2];
+
+            long size(int i) const { return sizes[i]; }
+            void set_size(int i, long n) { sizes[i] = n; }
+        };
+
+        template <int SIZE>
+        struct subtreesizes<SIZE, false> {
+            long size(int) const { return 0; }
+            void set_size(int, long) {}
+        };
+
+        template <class T, int BSTAR_ORDER = 3, bool COUNTED = false>
+        class Node : public subtreesizes<BSTAR_ORDER, COUNTED> {
         public:
+            using subtreesizes<BSTAR_ORDER, COUNTED>::size;
+            using subtreesizes<BSTAR_ORDER, COUNTED>::set_size;
+
             long page_id = -1;
             long count = 0;
             long erase = -1;
+            uint32_t checksum = 0;
 
             T keys[BSTAR_ORDER + 1];
             long children[BSTAR_ORDER + 2];
@@ -227,6 +388,7 @@ namespace utec {
                 count = 0;
                 for (int i = 0; i < BSTAR_ORDER + 2; i++) {
                     children[i] = 0;
+                    set_size(i, 0);
                 }
             }
 
@@ -234,36 +396,78 @@ namespace utec {
                 int j = count;
                 while (j > pos) {
                     keys[j] = keys[j - 1];
-                    children[j + 1] = children[j];
+                    take(j + 1, *this, j);
                     j--;
                 }
                 keys[j] = value;
 
-                children[j + 1] = children[j];
+                take(j + 1, *this, j);
 
                 count++;
             }
 
             template <int SIZE>
-            void copy(Node<T, SIZE> &node, int s, int e, int j) {
+            void copy(Node<T, SIZE, COUNTED> &node, int s, int e, int j) {
                 int i;
                 for (i = s; i < e; i++) {
                     keys[i] = node.keys[j+i];
-                    children[i] = node.children[j+i];
+                    take(i, node, j+i);
+                }
+                take(i, node, j+i);
+
+            }
+
+            // Makes child i the j-th child of `node`, with its key count.
+            template <int SIZE>
+            void take(int i, const Node<T, SIZE, COUNTED> &node, int j) {
+                children[i] = node.children[j];
+                set_size(i, node.size(j));
+            }
+
+            // Keys in the subtree rooted here.
+            long total() const {
+                long n = count;
+                if (children[0]) {
+                    for (int i = 0; i <= count; i++) n += size(i);
                 }
-                children[i] = node.children[j+i];
+                return n;
+            }
+
+            // CRC-32C of the page image, taken with the checksum field zeroed.
+            uint32_t image_crc() const {
+                const char *p = reinterpret_cast<const char *>(this);
+                const char *c = reinterpret_cast<const char *>(&checksum);
+                uint32_t zero = 0;
+                uint32_t crc = crc32c::extend(0, p, c - p);
+                crc = crc32c::extend(crc, &zero, sizeof(zero));
+                return crc32c::extend(crc, c + sizeof(zero), sizeof(*this) - (c - p) - sizeof(zero));
+            }
+
+            void seal() { checksum = image_crc(); }
 
+            bool intact() const { return checksum == image_crc(); }
+
+            // Throws if the image read from `id` is torn or corrupt.
+            void check(long id) const {
+                if (!intact()) throw std::runtime_error("checksum mismatch on page " + std::to_string(id));
             }
         };  
 
 
-        template <class T, int BSTAR_ORDER = 3>
+        // With COUNTED every inner entry also records how many keys lie
+        // below it, which makes rank(), select() and count_range() cost one
+        // root-to-leaf path. Inserts then rewrite every node on their path.
+        //
+        // Keys are ordered by Compare alone. The Bloom filter and the hash
+        // index hash key bytes, so keys Compare finds equal must also be
+        // equal byte for byte; packed_key (utec/keys.h) is built for that.
+        template <class T, int BSTAR_ORDER = 3, bool COUNTED = false, class Compare = utec::less>
         class bstar {
         public:
             template <int SIZE = BSTAR_ORDER>
-            using Node = utec::disk::Node<T, SIZE>;
+            using Node = utec::disk::Node<T, SIZE, COUNTED>;
 
-            typedef bstariterator<T, BSTAR_ORDER> iterator;
+            typedef bstariterator<T, BSTAR_ORDER, COUNTED, Compare> iterator;
 
             enum state {
                 BT_OVERFLOW,
@@ -276,6 +480,9 @@ namespace utec {
                 S_BLOCK = (2*BSTAR_ORDER-1)/3,
                 T_BLOCK = (2*BSTAR_ORDER)/3,
                 H_BLOCK = (4*BSTAR_ORDER)/3,
+                READ_AHEAD = 4,
+                APPEND_RUN = 4,
+                HOT_PROBES = 3,
             };
 
             struct Metadata {
@@ -283,14 +490,202 @@ namespace utec {
                 long count{0};
                 long size{0};
                 long erase{-1};
+                long bloom_bits{0};
+                long bloom_page{0};
+                long bloom_clean{0};
+                long checksum{0};
             } header;
 
+            // Findings of verify().
+            struct report {
+                long pages{0};      // pages scanned
+                long nodes{0};      // nodes reachable from the root, root included
+                long keys{0};
+                long free{0};       // pages on the free list
+                long thin{0};       // tolerated nodes below F_BLOCK keys
+                std::vector<std::string> errors;
+
+                bool ok() const { return errors.empty(); }
+            };
+
         private:
             std::shared_ptr<pagemanager> pm;
+            std::shared_ptr<catalog> cat;
+            long header_id{0};
+            Compare comp;
+
+            // Keys are equal when neither precedes the other.
+            bool same(const T &a, const T &b) const { return !comp(a, b) && !comp(b, a); }
+
+            bloomfilter bloom;
+            bool bloom_stale{false};
+            long bloom_removed{0};
+
+            // With a non-zero floor remove() leaves nodes thin down to it and
+            // queues a key of each for compact().
+            int relaxed{0};
+            std::vector<T> deferred;
+
+            // Page ids from the root down to the rightmost leaf, kept while
+            // inserts only append; empty when it has to be looked up again.
+            std::vector<long> spine;
+            T last_insert{};
+            int ascending{0};
+
+            // Adaptive hash index: keys lookup() keeps finding, mapped to the
+            // page that holds them. An entry is trusted only while the
+            // version of its page is unchanged; every write of a page bumps
+            // it except in-place leaf inserts, which move no key off a page.
+            struct hot_key {
+                long page_id;
+                uint64_t version;
+                bool referenced;
+            };
+
+            struct hot_page {
+                uint64_t version;
+                long refs;
+            };
+
+            struct key_hash {
+                std::size_t operator()(const T &k) const { return bloomhash<T>()(k); }
+            };
+
+            // Equality matching the hash (bytes unless specialised); Compare
+            // may not tell apart two keys this does.
+            struct key_equal {
+                bool operator()(const T &a, const T &b) const { return bloomequal<T>()(a, b); }
+            };
+
+            std::size_t hot_capacity{0};
+            std::unordered_map<T, hot_key, key_hash, key_equal> hot;
+            std::unordered_map<T, int, key_hash, key_equal> heat;
+            std::unordered_map<long, hot_page> hot_pages;
+
+            void save_header() {
+                header.checksum = 0;
+                header.checksum = crc32c::of(&header, sizeof(header));
+                pm->save(header_id, header);
+            }
+
+            void load_header() {
+                pm->recover(header_id, header);
+                long stored = header.checksum;
+                header.checksum = 0;
+                if(stored != (long) crc32c::of(&header, sizeof(header))){
+                    throw std::runtime_error("checksum mismatch on the header of " + pm->file_name());
+                }
+                header.checksum = stored;
+            }
+
+            // The persisted filter is flagged out of date before its first
+            // change, so a crash before save_bloom() forces a rebuild.
+            void bloom_touch() {
+                if(header.bloom_clean){
+                    header.bloom_clean = 0;
+                    save_header();
+                }
+            }
+
+            void bloom_add(const T &k) {
+                if(!header.bloom_bits) return;
+                bloom_touch();
+                if(bloom_stale) return;
+                bloom.add(bloomhash<T>()(k));
+                if(bloom.size() > bloom.capacity()) bloom_stale = true;
+            }
+
+            void bloom_removed_one() {
+                if(!header.bloom_bits) return;
+                bloom_touch();
+                if(++bloom_removed * 2 > bloom.size()) bloom_stale = true;
+            }
+
+            // True when the filter proves `k` is absent.
+            bool bloom_rejects(const T &k) {
+                if(!header.bloom_bits) return false;
+                if(bloom_stale) rebuild_bloom();
+                if(bloom.may_contain(bloomhash<T>()(k))) return false;
+                pm->stats().add(statistics::BLOOM_NEGATIVES);
+                return true;
+            }
+
+            // Sizes a fresh filter for twice the current key count.
+            void rebuild_bloom() {
+                std::vector<uint64_t> hashes;
+                for(iterator it = begin(); it != end(); ++it) hashes.push_back(bloomhash<T>()(*it));
+                bloom = bloomfilter(std::max<long>(2 * hashes.size(), 1024), header.bloom_bits);
+                for(uint64_t h : hashes) bloom.add(h);
+                bloom_stale = false;
+                bloom_removed = 0;
+            }
+
+            std::string bloom_file() {
+                return pm->file_name() + ".bloom";
+            }
+
+            // Inside a catalog the filter lives in a chain of pages, each
+            // starting with the id of the next one; a legacy index keeps it
+            // in a file next to the index.
+            void free_bloom_pages() {
+                long id = header.bloom_page;
+                while(id){
+                    long next;
+                    pm->recover_bytes(id, &next, sizeof(next));
+                    cat->release(id);
+                    id = next;
+                }
+                header.bloom_page = 0;
+            }
+
+            void store_bloom(const std::vector<char> &bytes) {
+                if(!cat){
+                    std::ofstream out(bloom_file().c_str(), std::ios::binary | std::ios::trunc);
+                    out.write(bytes.data(), bytes.size());
+                    return;
+                }
+                free_bloom_pages();
+                long chunk = pm->page_size() - sizeof(long);
+                long pages = (bytes.size() + chunk - 1) / chunk;
+                std::vector<long> ids;
+                for(long i = 0; i < pages; i++) ids.push_back(cat->allocate());
+                std::vector<char> page(pm->page_size());
+                for(long i = 0; i < pages; i++){
+                    long next = i + 1 < pages ? ids[i + 1] : 0;
+                    long n = std::min<long>(chunk, bytes.size() - i * chunk);
+                    std::memcpy(page.data(), &next, sizeof(next));
+                    std::memcpy(page.data() + sizeof(long), bytes.data() + i * chunk, n);
+                    pm->save_bytes(ids[i], page.data(), sizeof(long) + n);
+                }
+                header.bloom_page = pages ? ids[0] : 0;
+            }
+
+            bool load_bloom() {
+                std::vector<char> bytes;
+                if(!cat){
+                    std::ifstream in(bloom_file().c_str(), std::ios::binary);
+                    bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+                } else {
+                    std::vector<char> page(pm->page_size());
+                    for(long id = header.bloom_page; id; ){
+                        pm->recover_bytes(id, page.data(), page.size());
+                        bytes.insert(bytes.end(), page.begin() + sizeof(long), page.end());
+                        std::memcpy(&id, page.data(), sizeof(id));
+                    }
+                }
+                return bloom.deserialize(bytes);
+            }
+
+            void open_bloom() {
+                if(header.bloom_bits && !(header.bloom_clean && load_bloom())) bloom_stale = true;
+            }
 
             Node<> new_node() {
                 Node<> ret;
-                if(header.erase == -1){
+                if(cat){
+                    header.size++;
+                    ret.page_id = cat->allocate();
+                } else if(header.erase == -1){
                     header.count++;
                     header.size++;
                     ret.page_id = header.count+1;
@@ -300,35 +695,162 @@ namespace utec {
                     Node<> lnode = read_node(header.erase);
                     header.erase = lnode.erase;
                 }
-                pm->save(0, header);
+                save_header();
                 return ret;
             }
 
+            void free_node(Node<> &n) {
+                header.size--;
+                if(cat){
+                    touch(n.page_id);
+                    cat->release(n.page_id);
+                } else {
+                    n.erase = header.erase;
+                    header.erase = n.page_id;
+                    write_node(n.page_id, n);
+                }
+                save_header();
+            }
+
             Node<> read_node(long page_id) {
                 Node<> n{-1};
                 pm->recover(page_id, n);
+                n.check(page_id);
                 return n;
             }
 
             Node<2*F_BLOCK> read_root() {
                 Node<2*F_BLOCK> n{-1};
-                pm->recover(1, n);
+                pm->recover(header.root_id, n);
+                n.check(header.root_id);
                 return n;
             }
 
+            struct pending_read {
+                pagemanager::ticket ticket;
+                long page_id;
+                Node<> *node;
+            };
+
+            std::vector<pending_read> pending;
+
+            // Issues the reads of up to two sibling pages at once; an id of 0
+            // is skipped. Unless `wait` is set the caller must wait_nodes()
+            // before touching the nodes.
+            void read_nodes(long id1, Node<> &n1, long id2, Node<> &n2, bool wait = true) {
+                if(id1) pending.push_back(pending_read{pm->recover_async(id1, n1), id1, &n1});
+                if(id2) pending.push_back(pending_read{pm->recover_async(id2, n2), id2, &n2});
+                if(wait) wait_nodes();
+            }
+
+            void wait_nodes() {
+                std::vector<pending_read> done;
+                done.swap(pending);
+                for(auto &r : done) pm->wait(r.ticket);
+                for(auto &r : done) r.node->check(r.page_id);
+            }
+
             template <int SIZE>
-            bool write_node(long page_id, Node<SIZE> n) { 
+            void write_node(long page_id, Node<SIZE> n) { 
+                touch(page_id);
+                n.seal();
                 pm->save(page_id, n);
             }
 
+            // Writes a leaf that only gained keys; hash index entries for the
+            // keys it already had stay valid.
+            void write_in_place(Node<> &n) {
+                n.seal();
+                pm->save(n.page_id, n);
+            }
+
+            void touch(long page_id) {
+                if(hot_pages.empty()) return;
+                auto it = hot_pages.find(page_id);
+                if(it != hot_pages.end()) it->second.version++;
+            }
+
+            void drop_hot(typename std::unordered_map<T, hot_key, key_hash, key_equal>::iterator it) {
+                auto page = hot_pages.find(it->second.page_id);
+                if(!--page->second.refs) hot_pages.erase(page);
+                hot.erase(it);
+            }
+
+            void clear_hot() {
+                hot.clear();
+                heat.clear();
+                hot_pages.clear();
+            }
+
+            template <int SIZE>
+            bool in_page(const Node<SIZE> &n, const T &key, T &out, int &slot) {
+                slot = std::lower_bound(n.keys, n.keys + n.count, key, comp) - n.keys;
+                if(slot == n.count || !same(n.keys[slot], key)) return false;
+                out = n.keys[slot];
+                return true;
+            }
+
+            // Answers from the hash index with a single page read, giving
+            // the element and where it is; false if the key has no valid
+            // entry, which is then dropped.
+            bool probe_hot(const T &key, T &out, long &page_id, int &slot) {
+                auto it = hot.find(key);
+                if(it == hot.end()) return false;
+                long id = it->second.page_id;
+                if(hot_pages[id].version == it->second.version){
+                    bool found = id == header.root_id ? in_page(read_root(), key, out, slot)
+                                                      : in_page(read_node(id), key, out, slot);
+                    if(found){
+                        page_id = id;
+                        it->second.referenced = true;
+                        pm->stats().add(statistics::HASH_HITS);
+                        return true;
+                    }
+                }
+                drop_hot(it);
+                return false;
+            }
+
+            // Counts a lookup that found `key` on `page_id` and indexes the
+            // key once it has been found HOT_PROBES times. Counts are halved
+            // when the candidates outgrow four times the capacity.
+            void warm(const T &key, long page_id) {
+                int &h = heat[key];
+                if(++h < HOT_PROBES){
+                    if(heat.size() > 4 * hot_capacity){
+                        for(auto it = heat.begin(); it != heat.end(); ){
+                            if((it->second /= 2) == 0) it = heat.erase(it);
+                            else ++it;
+                        }
+                    }
+                    return;
+                }
+                heat.erase(key);
+                // Second chance: drop entries not hit since the last sweep.
+                for(int pass = 0; pass < 2 && hot.size() >= hot_capacity; pass++){
+                    for(auto it = hot.begin(); it != hot.end(); ){
+                        auto next = std::next(it);
+                        if(it->second.referenced) it->second.referenced = false;
+                        else drop_hot(it);
+                        it = next;
+                    }
+                }
+                hot_page &page = hot_pages[page_id];
+                page.refs++;
+                hot[key] = hot_key{page_id, page.version, false};
+            }
+
             template <int SIZE>
             void rotateLeft(Node<SIZE> &node, Node<> &n1, Node<> &n2, int pos){
+                pm->stats().add(statistics::ROTATE_LEFT);
                 n1.insert_in_node(n1.count, node.keys[pos]);
-                n1.children[n1.count] = n2.children[0];
+                n1.take(n1.count, n2, 0);
                 node.keys[pos] = n2.keys[0];
                 n2.count--;
 
                 n2.copy(n2, 0, n2.count, 1);
+                node.set_size(pos, n1.total());
+                node.set_size(pos+1, n2.total());
 
                 write_node(node.page_id, node);
                 write_node(n1.page_id, n1);
@@ -337,17 +859,23 @@ namespace utec {
 
             template <int SIZE>
             void rotateRight(Node<SIZE> &node, Node<> &n1, Node<> &n2, int pos){
+                pm->stats().add(statistics::ROTATE_RIGHT);
                 n1.insert_in_node(0, node.keys[pos]);
-                n1.children[0] = n2.children[n2.count--];
+                n1.take(0, n2, n2.count--);
                 node.keys[pos] = n2.keys[n2.count];
+                node.set_size(pos, n2.total());
+                node.set_size(pos+1, n1.total());
 
                 write_node(node.page_id, node);
                 write_node(n1.page_id, n1);
                 write_node(n2.page_id, n2);
             }
 
+            // Spreads the full children `fnode` and `snode`, one of them
+            // overflowing and the other the idx-th child of `node`, over three.
             template <int SIZE>
-            void split(Node<SIZE> &node, int idx){
+            void split(Node<SIZE> &node, int idx, Node<> &fnode, Node<> &snode){
+                pm->stats().add(statistics::SPLITS);
                 int fidx, sidx;
                 if(idx < node.count){
                     fidx = idx;
@@ -356,8 +884,6 @@ namespace utec {
                     fidx = idx-1;
                     sidx = idx;
                 }
-                Node<> fnode = read_node(node.children[fidx]);
-                Node<> snode = read_node(node.children[sidx]);
                 Node<> tnode = new_node();
 
                 int i, s=snode.count-T_BLOCK;
@@ -365,18 +891,21 @@ namespace utec {
                 snode.count -= T_BLOCK; tnode.count += T_BLOCK;
 
                 snode.insert_in_node(0, node.keys[fidx]);
-                snode.children[0] = fnode.children[fnode.count];
+                snode.take(0, fnode, fnode.count);
 
                 node.insert_in_node(sidx, snode.keys[--snode.count]);
-                node.children[sidx] = node.children[sidx+1];
+                node.take(sidx, node, sidx+1);
                 node.children[sidx+1] = tnode.page_id;
 
                 while (fnode.count > F_BLOCK+1) {
                     snode.insert_in_node(0, fnode.keys[--fnode.count]);
-                    snode.children[0] = fnode.children[fnode.count];
+                    snode.take(0, fnode, fnode.count);
                 }
 
                 node.keys[fidx] = fnode.keys[--fnode.count];
+                node.set_size(fidx, fnode.total());
+                node.set_size(sidx, snode.total());
+                node.set_size(sidx+1, tnode.total());
 
                 write_node(node.page_id, node);
                 write_node(fnode.page_id, fnode);
@@ -385,6 +914,7 @@ namespace utec {
             }
 
             void splitRoot(Node<2*F_BLOCK> &root){
+                pm->stats().add(statistics::ROOT_SPLITS);
                 Node<> left = new_node();
                 Node<> right = new_node();
                 T middle = root.keys[F_BLOCK];
@@ -398,44 +928,197 @@ namespace utec {
                 root.keys[0] = middle;
                 root.children[0] = left.page_id;
                 root.children[1] = right.page_id;
+                root.set_size(0, left.total());
+                root.set_size(1, right.total());
 
                 write_node(left.page_id, left);
                 write_node(right.page_id, right);
             }
 
+            // Child slot of `data` in `node`: before the first key not below it.
             template <int SIZE>
-            int insert(T data, Node<SIZE> &node){
+            int slot(const Node<SIZE> &node, const T &data) {
                 int i;
                 for(i=0; i<node.count; ++i)
-                    if(data<=node.keys[i]) break;
-                if(node.children[i]){
-                    Node<> prev = read_node(node.children[i-1]);
-                    Node<> temp = read_node(node.children[i]);
-                    Node<> next = read_node(node.children[i+1]);
-                    int status = insert(data,temp);
-                    if(status == BT_OVERFLOW){
-                        if(i<node.count && next.count < BSTAR_ORDER-1){
-                            rotateRight(node,next,temp,i);
-                            return NORMAL;
-                        }
-                        if(i && prev.count < BSTAR_ORDER-1){
-                            rotateLeft(node,prev,temp,i-1);
-                            return NORMAL;
+                    if(!comp(node.keys[i], data)) break;
+                return i;
+            }
+
+            // Hands an overflowing `child`, the i-th child of `node`, to a
+            // sibling with room, or splits it with a full one. Siblings are
+            // only read here, next before previous, and the previous one only
+            // once the next is known to be full; both go through
+            // read_nodes() like the siblings read by remove().
+            template <int SIZE>
+            void overflow(Node<SIZE> &node, Node<> &child, int i) {
+                Node<> next, prev, none;
+                if(i<node.count){
+                    read_nodes(node.children[i+1], next, 0, none);
+                    if(next.count < BSTAR_ORDER-1){
+                        rotateRight(node,next,child,i);
+                        return;
+                    }
+                }
+                if(i){
+                    read_nodes(node.children[i-1], prev, 0, none);
+                    if(prev.count < BSTAR_ORDER-1){
+                        rotateLeft(node,prev,child,i-1);
+                        return;
+                    }
+                }
+                if(i<node.count) split(node,i,child,next);
+                else split(node,i,prev,child);
+            }
+
+            // Descends once from the root recording the path, inserts into
+            // the leaf and settles overflows bottom-up. Without an overflow
+            // (and COUNTED sizes) nothing above the leaf is written. Returns
+            // true if the root changed; the caller writes it.
+            bool insert(const T &data, Node<2*F_BLOCK> &root){
+                std::vector<Node<>> path;
+                std::vector<int> slots;
+                int i = slot(root, data);
+                for(long id = root.children[i]; id; id = path.back().children[i]){
+                    slots.push_back(i);
+                    path.push_back(read_node(id));
+                    i = slot(path.back(), data);
+                }
+                if(path.empty()){
+                    root.insert_in_node(i, data);
+                    return true;
+                }
+                path.back().insert_in_node(i, data);
+                write_in_place(path.back());
+
+                for(int d = path.size()-1; d >= 0; d--){
+                    Node<> &child = path[d];
+                    if(child.count == BSTAR_ORDER){
+                        if(d) overflow(path[d-1], child, slots[d]);
+                        else overflow(root, child, slots[d]);
+                    } else if(COUNTED){
+                        if(d){
+                            path[d-1].set_size(slots[d], child.total());
+                            write_node(path[d-1].page_id, path[d-1]);
+                        } else {
+                            root.set_size(slots[d], child.total());
                         }
-                        split(node,i);
+                    } else {
+                        return false;
                     }
+                }
+                return true;
+            }
+
+            void find_spine() {
+                Node<2*F_BLOCK> root = read_root();
+                spine.assign(1, root.page_id);
+                for(long id = root.children[root.count]; id; ){
+                    spine.push_back(id);
+                    Node<> n = read_node(id);
+                    id = n.children[n.count];
+                }
+            }
+
+            // Makes `right` the new last child of `n`, after `key`; `below` is
+            // the new key count of the child it follows.
+            template <int SIZE>
+            void adopt(Node<SIZE> &n, const T &key, long below, const Node<> &right) {
+                n.set_size(n.count, below);
+                n.keys[n.count] = key;
+                n.children[n.count+1] = right.page_id;
+                n.set_size(n.count+1, right.total());
+                n.count++;
+            }
+
+            // Adds `k` above the largest key along the cached rightmost path,
+            // reading no siblings. A full leaf hands its last key up as the
+            // separator of a new right leaf holding `k`, and a full inner
+            // node passes its last child and key to a new right sibling the
+            // same way, so the pages left behind stay full and only the right
+            // edge is thin. Returns false without writing anything if `k` is
+            // not above every key or the whole path is full.
+            bool append(const T &k) {
+                if(spine.empty()) find_spine();
+                int depth = spine.size() - 1;
+                Node<2*F_BLOCK> root{-1};
+                if(!depth){
+                    root = read_root();
+                    if(!root.count || !comp(root.keys[root.count-1], k) || root.count >= 2*F_BLOCK) return false;
+                    root.insert_in_node(root.count, k);
+                    write_node(root.page_id, root);
+                    return true;
+                }
+                std::vector<Node<>> path(depth + 1);
+                Node<> &leaf = path[depth] = read_node(spine[depth]);
+                if(!leaf.count || !comp(leaf.keys[leaf.count-1], k)) return false;
+                int room = depth;
+                if(leaf.count >= BSTAR_ORDER-1){
+                    for(room = depth-1; room > 0; room--){
+                        path[room] = read_node(spine[room]);
+                        if(path[room].count < BSTAR_ORDER-1) break;
+                    }
+                    if(!room){
+                        root = read_root();
+                        if(root.count >= 2*F_BLOCK) return false;
+                    }
+                }
+                pm->stats().add(statistics::APPENDS);
+
+                if(room == depth){
+                    leaf.insert_in_node(leaf.count, k);
+                    write_in_place(leaf);
                 } else {
-                    node.insert_in_node(i, data);
-                    write_node(node.page_id, node);
+                    Node<> right(new_node().page_id);
+                    right.keys[0] = k;
+                    right.count = 1;
+                    T up = leaf.keys[--leaf.count];
+                    long below = leaf.total();
+                    write_node(leaf.page_id, leaf);
+                    write_node(right.page_id, right);
+                    spine[depth] = right.page_id;
+                    for(int d = depth-1; d > room; d--){
+                        Node<> &n = path[d];
+                        Node<> next(new_node().page_id);
+                        next.keys[0] = up;
+                        next.children[0] = n.children[n.count];
+                        next.set_size(0, below);
+                        next.children[1] = right.page_id;
+                        next.set_size(1, right.total());
+                        next.count = 1;
+                        up = n.keys[--n.count];
+                        below = n.total();
+                        write_node(n.page_id, n);
+                        write_node(next.page_id, next);
+                        spine[d] = next.page_id;
+                        right = next;
+                    }
+                    if(room){
+                        adopt(path[room], up, below, right);
+                        write_node(path[room].page_id, path[room]);
+                    } else {
+                        adopt(root, up, below, right);
+                        write_node(root.page_id, root);
+                    }
                 }
-                if(node.count==BSTAR_ORDER) {
-                    return BT_OVERFLOW;
+                // The subtree sizes along the rest of the path grow by one.
+                if(COUNTED){
+                    for(int d = room-1; d > 0; d--){
+                        Node<> n = read_node(spine[d]);
+                        n.set_size(n.count, n.size(n.count) + 1);
+                        write_node(n.page_id, n);
+                    }
+                    if(room){
+                        root = read_root();
+                        root.set_size(root.count, root.size(root.count) + 1);
+                        write_node(root.page_id, root);
+                    }
                 }
-                return NORMAL;
+                return true;
             }
 
             template <int SIZE>
             void merge(Node<SIZE> &node, Node<> &n1, Node<> &n2, Node<> &n3, int pos){
+                pm->stats().add(statistics::MERGES);
 
                 Node<2*BSTAR_ORDER> tmp;
 
@@ -459,23 +1142,35 @@ namespace utec {
 
                 for(i=pos+2; i<node.count; i++){
                     node.keys[i-1] = node.keys[i];
-                    node.children[i] = node.children[i+1];
+                    node.take(i, node, i+1);
                 }
                 node.count--;
+                node.set_size(pos, n1.total());
+                node.set_size(pos+1, n2.total());
 
-                n3.erase = header.erase;
-                header.erase = n3.page_id;
-                header.size--;
-                pm->save(0, header);
+                free_node(n3);
 
                 write_node(node.page_id, node);
                 write_node(n1.page_id, n1);
                 write_node(n2.page_id, n2);
-                write_node(n3.page_id, n3);
+            }
+
+            // merge() needs the siblings at their minimum fill; nodes left
+            // thin by deferred removes are refilled instead.
+            template <int SIZE>
+            void merge_or_refill(Node<SIZE> &node, Node<> &n1, Node<> &n2, Node<> &n3, int pos, int i){
+                if(n1.count + n2.count + n3.count + 2 >= BSTAR_ORDER + F_BLOCK){
+                    merge(node, n1, n2, n3, pos);
+                    return;
+                }
+                std::vector<T> thin;
+                if(refill(node, i, false, thin) < 0) refill(node, i, true, thin);
+                deferred.insert(deferred.end(), thin.begin(), thin.end());
             }
 
             template <int SIZE>
             void mergeRoot(Node<SIZE> &node){
+                pm->stats().add(statistics::ROOT_MERGES);
                 Node<> n1 = read_node(node.children[0]); 
                 Node<> n2 = read_node(node.children[1]);
 
@@ -485,32 +1180,27 @@ namespace utec {
                 node.copy(n2, n1.count+1, n2.count+n1.count+1, -n1.count-1);
                 node.count += n2.count;
 
-                n1.erase = header.erase;
-                n2.erase = n1.page_id;
-                header.erase = n2.page_id;
-                header.size -= 2;
-                pm->save(0, header);
+                free_node(n1);
+                free_node(n2);
 
                 write_node(node.page_id, node);
-                write_node(n1.page_id, n1);
-                write_node(n2.page_id, n2);
             }
 
 
             template <int SIZE>
-            bool remove(T data, T* &temp, Node<SIZE> &node){
+            bool remove(const T &data, T* &temp, Node<SIZE> &node){
                 int i;
                 
                 for(i=0; i<node.count; ++i){
-                    if(data<=node.keys[i]) break;
+                    if(!comp(node.keys[i], data)) break;
                 }
 
                 if(!node.children[i]){
-                    if(data != node.keys[i] && !temp) 
+                    if(!temp && (i == node.count || !same(data, node.keys[i])))
                         return false;
                     if(i==node.count) --i;
-                    if(temp && *temp != node.keys[i]) {
-                        swap(*temp,node.keys[i]);
+                    if(temp && !same(*temp, node.keys[i])) {
+                        std::swap(*temp,node.keys[i]);
                     }
                     for(int idx=i; idx<node.count; idx++){
                         node.keys[idx] = node.keys[idx+1];
@@ -520,19 +1210,36 @@ namespace utec {
                     return true;
                 }
 
-                if(i<node.count && data == node.keys[i]) temp=&node.keys[i];
+                if(i<node.count && same(data, node.keys[i])) temp=&node.keys[i];
+                bool holds = temp == &node.keys[i];
                 Node<> n = read_node(node.children[i]);
                 if(!remove(data,temp,n)) return false;
-                
+                node.set_size(i, n.total());
+
+                auto size = n.count;
+                if(relaxed){
+                    // Each frame writes its own node, and only if it changed.
+                    if(holds || COUNTED) write_node(node.page_id, node);
+                    if(size >= F_BLOCK) return true;
+                    if(size >= relaxed){
+                        deferred.push_back(n.keys[0]);
+                        return true;
+                    }
+                    // Siblings may be thin too, which rotate and merge do not expect.
+                    std::vector<T> thin;
+                    if(refill(node, i, false, thin) < 0) refill(node, i, true, thin);
+                    deferred.insert(deferred.end(), thin.begin(), thin.end());
+                    return true;
+                }
+
                 write_node(n.page_id, n);
                 write_node(node.page_id, node);
 
-                auto size = n.count;
                 if(size < F_BLOCK){
                     if(i==0) {
                         Node<> next, next2;
-                        next = read_node(node.children[i+1]);    
-                        if(node.count > 1) next2 = read_node(node.children[i+2]);
+                        read_nodes(node.children[i+1], next,
+                                   node.count > 1 ? node.children[i+2] : 0, next2);
 
                         auto size_r = next.count;
                         if(size_r > F_BLOCK){
@@ -542,16 +1249,16 @@ namespace utec {
                             size = n.count;
                             rotateLeft(node,n,next,i);
                         } else {
-                            if(node.page_id == 1 && node.count == 1) {
+                            if(node.page_id == header.root_id && node.count == 1) {
                                 mergeRoot(node);
                             } else {
-                                merge(node, n, next, next2, i);
+                                merge_or_refill(node, n, next, next2, i, i);
                             }
                         }
                     } else if(i==node.count){
                         Node<> prev, prev2;
-                        prev = read_node(node.children[i-1]);    
-                        if(node.count > 1) prev2 = read_node(node.children[i-2]);
+                        read_nodes(node.children[i-1], prev,
+                                   node.count > 1 ? node.children[i-2] : 0, prev2);
 
                         auto size_l = prev.count;
                         if(size_l > F_BLOCK){
@@ -562,17 +1269,16 @@ namespace utec {
                             size = n.count;
                             rotateRight(node,n,prev,i-1);
                         } else {
-                            if(node.page_id == 1 && node.count == 1) {
+                            if(node.page_id == header.root_id && node.count == 1) {
                                 mergeRoot(node);
                             } else {
-                                merge(node, prev2, prev, n, i-2);
+                                merge_or_refill(node, prev2, prev, n, i-2, i);
                             }
                         }
 
                     } else {
                         Node<> prev, next;
-                        prev = read_node(node.children[i-1]);    
-                        next = read_node(node.children[i+1]);
+                        read_nodes(node.children[i-1], prev, node.children[i+1], next);
 
                         auto size_l = prev.count;
                         auto size_r = next.count;
@@ -581,10 +1287,10 @@ namespace utec {
                         } else if(size_r > F_BLOCK){
                             rotateLeft(node,n,next,i);
                         } else {
-                            if(node.page_id == 1 && node.count == 1) {
+                            if(node.page_id == header.root_id && node.count == 1) {
                                 mergeRoot(node);
                             } else {
-                                merge(node, prev, n, next, i-1);
+                                merge_or_refill(node, prev, n, next, i-1, i);
                             }
                         }
                     }
@@ -678,51 +1384,1129 @@ namespace utec {
                 }
             }
 
+            // Page and slot of the stored element equal to `key`.
+            bool locate(const T &key, long &page_id, int &slot) {
+                Node<2*F_BLOCK> root = read_root();
+                int i = 0;
+                while(i < root.count && comp(root.keys[i], key)) i++;
+                if(i < root.count && same(key, root.keys[i])){
+                    page_id = root.page_id;
+                    slot = i;
+                    return true;
+                }
+                long id = root.children[i];
+                while(id){
+                    Node<> n = read_node(id);
+                    i = 0;
+                    while(i < n.count && comp(n.keys[i], key)) i++;
+                    if(i < n.count && same(key, n.keys[i])){
+                        page_id = id;
+                        slot = i;
+                        return true;
+                    }
+                    id = n.children[i];
+                }
+                return false;
+            }
+
+            // Adds the keys of `n` (and the subtrees left of them) that come
+            // before `key`, returning the child to descend into.
+            template <int SIZE>
+            long rank_step(Node<SIZE> &n, const T &key, bool inclusive, long &r) {
+                int i = 0;
+                while(i < n.count && (inclusive ? !comp(key, n.keys[i]) : comp(n.keys[i], key))){
+                    r += (n.children[0] ? n.size(i) : 0) + 1;
+                    i++;
+                }
+                return n.children[i];
+            }
+
+            long rank_of(const T &key, bool inclusive) {
+                static_assert(COUNTED, "rank queries need a bstar with COUNTED set");
+                Node<2*F_BLOCK> root = read_root();
+                long r = 0;
+                long id = rank_step(root, key, inclusive, r);
+                while(id){
+                    Node<> n = read_node(id);
+                    id = rank_step(n, key, inclusive, r);
+                }
+                return r;
+            }
+
+            // Moves to the child holding the k-th key, or stores the key in
+            // `out` and returns 0 when it is in `n` itself.
+            template <int SIZE>
+            long select_step(Node<SIZE> &n, long &k, T &out) {
+                for(int i=0; i<=n.count; i++){
+                    long below = n.children[0] ? n.size(i) : 0;
+                    if(k < below) return n.children[i];
+                    k -= below;
+                    if(i < n.count && k-- == 0){
+                        out = n.keys[i];
+                        return 0;
+                    }
+                }
+                return 0;
+            }
+
+            // One level of a bottom-up load: `keys` keys spread evenly over
+            // `nodes` nodes, with the nodes-1 keys between them passed up.
+            struct loadlevel {
+                long keys;
+                long nodes;
+                long index;
+                Node<> cur;
+
+                long quota() const {
+                    long stored = keys - (nodes - 1);
+                    return stored / nodes + (index < stored % nodes);
+                }
+            };
+
+            // Fewest nodes that hold `n` keys at about `target` keys each
+            // while staying between F_BLOCK and BSTAR_ORDER-1 keys.
+            static long plan_nodes(long n, long target) {
+                long nodes = (n + 1 + target) / (target + 1);
+                while(nodes > 1 && n + 1 < nodes * (F_BLOCK + 1)) nodes--;
+                while(n + 1 > nodes * BSTAR_ORDER) nodes++;
+                return nodes;
+            }
+
+            // Appends `key` to level k; `child` is the node to its right and
+            // `left` the key count of the node to its left.
+            void load_push(std::vector<loadlevel> &levels, Node<2*F_BLOCK> &root, std::size_t k,
+                           const T &key, long child, long left) {
+                if(k == levels.size()){
+                    root.set_size(root.count, left);
+                    root.keys[root.count] = key;
+                    root.children[++root.count] = child;
+                    return;
+                }
+                loadlevel &l = levels[k];
+                l.cur.set_size(l.cur.count, left);
+                if(l.cur.count < l.quota()){
+                    l.cur.keys[l.cur.count] = key;
+                    l.cur.children[++l.cur.count] = child;
+                    return;
+                }
+                long total = l.cur.total();
+                write_node(l.cur.page_id, l.cur);
+                l.index++;
+                l.cur = Node<>(new_node().page_id);
+                l.cur.children[0] = child;
+                load_push(levels, root, k + 1, key, l.cur.page_id, total);
+            }
+
+            // In-order walk of the keys in [*lo, hi) (or [*lo, hi] when
+            // `closed`) below `n`; a null `lo` starts at the first key.
+            // Returns false once a key past the end was seen.
+            template <int SIZE, class Visitor>
+            bool scan_node(Node<SIZE> &n, const T *lo, const T &hi, bool closed, Visitor &visit) {
+                int i = 0;
+                if(lo) while(i < n.count && comp(n.keys[i], *lo)) i++;
+                for(; i<=n.count; i++){
+                    if(n.children[i]){
+                        for(int j=i+1; j<=n.count && j<=i+READ_AHEAD; j++) pm->prefetch<Node<>>(n.children[j]);
+                        Node<> child = read_node(n.children[i]);
+                        if(!scan_node(child, lo, hi, closed, visit)) return false;
+                        lo = 0;
+                    }
+                    if(i == n.count) break;
+                    if(closed ? comp(hi, n.keys[i]) : !comp(n.keys[i], hi)) return false;
+                    visit(n.keys[i]);
+                }
+                return true;
+            }
+
+            // In-order walk of every key below `n`.
+            template <int SIZE, class Visitor>
+            void walk(Node<SIZE> &n, Visitor &visit) {
+                for(int i=0; i<=n.count; i++){
+                    if(n.children[i]){
+                        for(int j=i+1; j<=n.count && j<=i+READ_AHEAD; j++) pm->prefetch<Node<>>(n.children[j]);
+                        Node<> child = read_node(n.children[i]);
+                        walk(child, visit);
+                    }
+                    if(i < n.count) visit(n.keys[i]);
+                }
+            }
+
+            // Separator keys strictly inside (lo, hi) from the top `depth`
+            // levels, in order.
+            template <int SIZE>
+            void separators(Node<SIZE> &n, const T &lo, const T &hi, int depth, std::vector<T> &out) {
+                for(int i=0; i<=n.count; i++){
+                    bool below = i == n.count || comp(lo, n.keys[i]);
+                    bool above = i == 0 || comp(n.keys[i-1], hi);
+                    if(depth > 1 && n.children[i] && below && above){
+                        Node<> child = read_node(n.children[i]);
+                        separators(child, lo, hi, depth - 1, out);
+                    }
+                    if(i < n.count && comp(lo, n.keys[i]) && comp(n.keys[i], hi)) out.push_back(n.keys[i]);
+                }
+            }
+
+            // Keys and child links of a run of sibling nodes, the separators
+            // between them included: children[i] lies left of keys[i].
+            struct pool {
+                std::vector<T> keys;
+                std::vector<long> children;
+                std::vector<long> sizes;
+
+                void child(long id, long size) {
+                    children.push_back(id);
+                    sizes.push_back(size);
+                }
+            };
+
+            template <int SIZE>
+            void gather(const Node<SIZE> &n, pool &p) {
+                for(int i=0; i<n.count; i++){
+                    p.child(n.children[i], n.size(i));
+                    p.keys.push_back(n.keys[i]);
+                }
+                p.child(n.children[n.count], n.size(n.count));
+            }
+
+            // Fills `n` with `count` keys of `p` starting at `first`.
+            template <int SIZE>
+            void scatter(Node<SIZE> &n, const pool &p, std::size_t first, int count) {
+                for(int i=0; i<count; i++){
+                    n.keys[i] = p.keys[first+i];
+                    n.children[i] = p.children[first+i];
+                    n.set_size(i, p.sizes[first+i]);
+                }
+                n.children[count] = p.children[first+count];
+                n.set_size(count, p.sizes[first+count]);
+                n.count = count;
+            }
+
+            // Appends the pages of the subtree under `id`, `height` levels
+            // tall, to `ids`. Leaves are listed without being read.
+            void subtree_pages(long id, int height, std::vector<long> &ids) {
+                ids.push_back(id);
+                if(height == 1) return;
+                Node<> n = read_node(id);
+                for(int i=0; i<=n.count; i++) subtree_pages(n.children[i], height - 1, ids);
+            }
+
+            // Returns pages to the free list with a single header write.
+            void free_pages(const std::vector<long> &ids) {
+                if(ids.empty()) return;
+                for(long id : ids){
+                    if(cat){
+                        touch(id);
+                        cat->release(id);
+                    } else {
+                        Node<> n{id};
+                        n.erase = header.erase;
+                        header.erase = id;
+                        write_node(id, n);
+                    }
+                }
+                header.size -= ids.size();
+                save_header();
+            }
+
+            int height() {
+                Node<2*F_BLOCK> root = read_root();
+                int h = 1;
+                for(long id = root.children[0]; id; id = read_node(id).children[0]) h++;
+                return h;
+            }
+
+            // Drops the keys of `node` in [lo, hi] and queues the subtrees
+            // lying wholly inside the range in `freed`. `lo_in`/`hi_in` tell
+            // whether the node's lower/upper bound is itself in the range.
+            // Nodes are left as thin as the range makes them for
+            // repair_range() to fix. If children survive on both sides of the
+            // range, one key in range stays between them as `hold`.
+            template <int SIZE>
+            bool erase_range(Node<SIZE> &node, int height, const T &lo, const T &hi, bool lo_in, bool hi_in,
+                             std::vector<long> &freed, bool &held, T &hold) {
+                int a = 0;
+                while(a < node.count && comp(node.keys[a], lo)) a++;
+                int b = a;
+                while(b < node.count && !comp(hi, node.keys[b])) b++;
+
+                if(height == 1){
+                    if(a == b) return false;
+                    for(int i=b; i<node.count; i++) node.keys[i-(b-a)] = node.keys[i];
+                    node.count -= b - a;
+                    write_node(node.page_id, node);
+                    return true;
+                }
+
+                if(a == b){
+                    Node<> child = read_node(node.children[a]);
+                    if(!erase_range(child, height - 1, lo, hi, a == 0 && lo_in, a == node.count && hi_in,
+                                    freed, held, hold)) return false;
+                    if(COUNTED){
+                        node.set_size(a, child.total());
+                        write_node(node.page_id, node);
+                    }
+                    return true;
+                }
+
+                // Keys [a, b) are in range and so are the children between them.
+                bool left_in = a == 0 && lo_in;
+                bool right_in = b == node.count && hi_in;
+                bool keep_left = !left_in || right_in;
+                bool keep_right = !right_in;
+                for(int i=a+1; i<b; i++) subtree_pages(node.children[i], height - 1, freed);
+
+                pool p;
+                for(int i=0; i<a; i++){
+                    p.child(node.children[i], node.size(i));
+                    p.keys.push_back(node.keys[i]);
+                }
+                if(keep_left){
+                    Node<> child = read_node(node.children[a]);
+                    erase_range(child, height - 1, lo, hi, left_in, true, freed, held, hold);
+                    p.child(child.page_id, child.total());
+                } else {
+                    subtree_pages(node.children[a], height - 1, freed);
+                }
+                if(keep_left && keep_right){
+                    held = true;
+                    hold = node.keys[a];
+                    p.keys.push_back(hold);
+                }
+                if(keep_right){
+                    Node<> child = read_node(node.children[b]);
+                    erase_range(child, height - 1, lo, hi, true, right_in, freed, held, hold);
+                    p.child(child.page_id, child.total());
+                } else {
+                    subtree_pages(node.children[b], height - 1, freed);
+                }
+                for(int i=b; i<node.count; i++){
+                    p.keys.push_back(node.keys[i]);
+                    p.child(node.children[i+1], node.size(i+1));
+                }
+                scatter(node, p, 0, p.keys.size());
+                write_node(node.page_id, node);
+                return true;
+            }
+
+            // Child of `n` on the path to `key`; with `after` set, keys equal
+            // to `key` are passed on the left.
+            template <int SIZE>
+            int path_index(const Node<SIZE> &n, const T &key, bool after) {
+                int i = 0;
+                while(i < n.count && (after ? !comp(key, n.keys[i]) : comp(n.keys[i], key))) i++;
+                return i;
+            }
+
+            // Pulls the only child of an empty root into the root page.
+            bool collapse_root() {
+                Node<2*F_BLOCK> root = read_root();
+                if(root.count || !root.children[0]) return false;
+                Node<> child = read_node(root.children[0]);
+                pool p;
+                gather(child, p);
+                scatter(root, p, 0, child.count);
+                write_node(root.page_id, root);
+                free_pages(std::vector<long>(1, child.page_id));
+                return true;
+            }
+
+            // Refills child i of `parent` by spreading the keys of a run of
+            // its siblings over as few nodes as hold them. The run starts with
+            // up to three nodes and widens until every node ends with at least
+            // F_BLOCK keys. Returns 1 after a change, 0 if there was nothing
+            // to do and -1 if the whole parent is too small, unless `settle`
+            // accepts thin nodes then; a key of each is added to `thin`. When
+            // all the children fit in the root they are folded into it.
+            template <int SIZE>
+            int refill(Node<SIZE> &parent, int i, bool settle, std::vector<T> &thin) {
+                int first = std::max(0, i-1), last = std::min<int>(parent.count, i+1);
+                if(last - first < 2 && first > 0) first--;
+                if(last - first < 2 && last < parent.count) last++;
+                if(first == last) return 0;
+                bool is_root = parent.page_id == header.root_id;
+                while(true){
+                    int m = last - first + 1;
+                    pool p;
+                    std::vector<long> ids;
+                    std::vector<int> before;
+                    for(int j=first; j<=last; j++){
+                        Node<> n = read_node(parent.children[j]);
+                        gather(n, p);
+                        if(j < last) p.keys.push_back(parent.keys[j]);
+                        ids.push_back(n.page_id);
+                        before.push_back(n.count);
+                    }
+                    long keys = p.keys.size();
+
+                    if(is_root && m == parent.count + 1 && keys <= 2*F_BLOCK){
+                        scatter(parent, p, 0, keys);
+                        write_node(parent.page_id, parent);
+                        free_pages(ids);
+                        return 1;
+                    }
+
+                    int nodes = 1;
+                    while(keys - (nodes - 1) > nodes * (BSTAR_ORDER - 1)) nodes++;
+                    long stored = keys - (nodes - 1);
+                    bool whole = first == 0 && last == parent.count;
+                    if(stored / nodes < F_BLOCK && !whole){
+                        if(last < parent.count) last++;
+                        else first--;
+                        continue;
+                    }
+                    if(stored / nodes < F_BLOCK && !is_root && !settle) return -1;
+
+                    std::vector<int> after;
+                    for(int j=0; j<nodes; j++) after.push_back(stored / nodes + (j < stored % nodes));
+                    if(nodes == m && after == before) return 0;
+
+                    pool up;
+                    for(int j=0; j<first; j++){
+                        up.child(parent.children[j], parent.size(j));
+                        up.keys.push_back(parent.keys[j]);
+                    }
+                    std::size_t at = 0;
+                    for(int j=0; j<nodes; j++){
+                        Node<> n{ids[j]};
+                        scatter(n, p, at, after[j]);
+                        write_node(n.page_id, n);
+                        if(after[j] < F_BLOCK) thin.push_back(n.keys[0]);
+                        at += after[j];
+                        up.child(n.page_id, n.total());
+                        if(j + 1 < nodes) up.keys.push_back(p.keys[at++]);
+                    }
+                    for(int j=last; j<parent.count; j++){
+                        up.keys.push_back(parent.keys[j]);
+                        up.child(parent.children[j+1], parent.size(j+1));
+                    }
+                    scatter(parent, up, 0, up.keys.size());
+                    write_node(parent.page_id, parent);
+                    free_pages(std::vector<long>(ids.begin() + nodes, ids.end()));
+                    return 1;
+                }
+            }
+
+            int refill(long parent_id, int i, bool settle, std::vector<T> &thin) {
+                if(parent_id == header.root_id){
+                    Node<2*F_BLOCK> root = read_root();
+                    return refill(root, i, settle, thin);
+                }
+                Node<> n = read_node(parent_id);
+                return refill(n, i, settle, thin);
+            }
+
+            // Fixes the first thin node on the path to `key`. A parent too
+            // small to refill its child is first evened out with its own
+            // siblings.
+            bool repair_path(const T &key, bool after, std::vector<T> &thin) {
+                Node<2*F_BLOCK> root = read_root();
+                std::vector<long> ids(1, root.page_id);
+                std::vector<int> slots;
+                long id = root.children[path_index(root, key, after)];
+                slots.push_back(path_index(root, key, after));
+                while(id){
+                    Node<> n = read_node(id);
+                    if(n.count < F_BLOCK){
+                        int done = refill(ids.back(), slots.back(), false, thin);
+                        if(done < 0 && ids.size() > 1) done = refill(ids[ids.size()-2], slots[slots.size()-2], false, thin);
+                        if(done <= 0) done = refill(ids.back(), slots.back(), true, thin);
+                        if(done > 0) return true;
+                    }
+                    ids.push_back(id);
+                    slots.push_back(path_index(n, key, after));
+                    id = n.children[slots.back()];
+                }
+                return false;
+            }
+
+            // erase_range() only thins the nodes bordering the removed range,
+            // which lie on the paths to `lo` and past `hi`; refill() reports
+            // any node it had to leave thin elsewhere.
+            void repair_range(const T &lo, const T &hi) {
+                std::vector<T> thin;
+                while(collapse_root() || repair_path(lo, false, thin) || repair_path(hi, true, thin) ||
+                      repair_thin(thin));
+            }
+
+            bool repair_thin(std::vector<T> &thin) {
+                while(!thin.empty()){
+                    T key = thin.back();
+                    if(repair_path(key, false, thin)) return true;
+                    thin.pop_back();
+                }
+                return false;
+            }
+
+            // Level-order list of every non-root page together with the position
+            // of its parent (-1 for the root). Leaves are not read.
+            void scan_layout(std::vector<long> &pages, std::vector<long> &parent) {
+                Node<2*F_BLOCK> root = read_root();
+                if(!root.children[0]) return;
+
+                int height = 1;
+                Node<> n = read_node(root.children[0]);
+                while(n.children[0]){
+                    height++;
+                    n = read_node(n.children[0]);
+                }
+
+                for(int i=0; i<=root.count; i++){
+                    pages.push_back(root.children[i]);
+                    parent.push_back(-1);
+                }
+                std::size_t level = 0;
+                for(int depth=1; depth<height; depth++){
+                    std::size_t end = pages.size();
+                    for(std::size_t k=level; k<end; k++){
+                        Node<> node = read_node(pages[k]);
+                        for(int i=0; i<=node.count; i++){
+                            pages.push_back(node.children[i]);
+                            parent.push_back(k);
+                        }
+                    }
+                    level = end;
+                }
+            }
+
+            template <int SIZE>
+            void exchange(Node<SIZE> &node, long a, long b) {
+                for(int i=0; i<=node.count; i++){
+                    if(node.children[i] == a) node.children[i] = b;
+                    else if(node.children[i] == b) node.children[i] = a;
+                }
+                write_node(node.page_id, node);
+            }
+
+            void exchange(long page_id, long a, long b) {
+                if(page_id == header.root_id){
+                    Node<2*F_BLOCK> root = read_root();
+                    exchange(root, a, b);
+                } else {
+                    Node<> node = read_node(page_id);
+                    exchange(node, a, b);
+                }
+            }
+
+            void unlink_free(long page_id, long replacement) {
+                if(header.erase == page_id){
+                    header.erase = replacement;
+                    save_header();
+                    return;
+                }
+                long id = header.erase;
+                while(id != -1){
+                    Node<> n = read_node(id);
+                    if(n.erase == page_id){
+                        n.erase = replacement;
+                        write_node(id, n);
+                        return;
+                    }
+                    id = n.erase;
+                }
+            }
+
+            // What verify() keeps of a scanned page: all keys and children
+            // of an inner node, only the first and last key of a leaf.
+            struct pageinfo {
+                bool intact{false};
+                bool sorted{true};
+                bool leaf{true};
+                long count{0};
+                long link{-1};
+                std::vector<T> keys;
+                std::vector<long> children, sizes;
+            };
+
+            struct verify_walk {
+                report &r;
+                std::vector<pageinfo> &info;
+                std::vector<char> seen;
+                long first;
+                int leaf_depth;
+                bool tolerant;
+            };
+
+            // Decodes pages [from, to) read in chunks of about 1 MB. `link`
+            // is the free-list successor: a node's erase field, or the first
+            // word of a page released to the catalog.
+            void scan_pages(int fd, long from, long to, long stride, long first, std::vector<pageinfo> &info) {
+                long batch = std::max<long>(1, (1 << 20) / stride);
+                std::size_t image = std::min<std::size_t>(stride, sizeof(Node<>));
+                std::vector<char> buf(batch * stride);
+                for(long id = from; id < to; id += batch){
+                    long n = std::min(batch, to - id);
+                    ssize_t got = ::pread(fd, buf.data(), n * stride, id * stride);
+                    for(long k = 0; k < n; k++){
+                        pageinfo &p = info[id + k - first];
+                        const char *page = buf.data() + k * stride;
+                        if(got < (ssize_t) (k * stride + image)) break;
+                        Node<> node{-1};
+                        std::memcpy(&node, page, image);
+                        if(cat) std::memcpy(&p.link, page, sizeof(long));
+                        else p.link = node.erase;
+                        p.intact = node.intact() && node.count >= 0 && node.count <= BSTAR_ORDER;
+                        if(!p.intact) continue;
+                        p.count = node.count;
+                        p.leaf = !node.children[0];
+                        for(int i = 1; i < node.count; i++) if(comp(node.keys[i], node.keys[i-1])) p.sorted = false;
+                        if(!node.count) continue;
+                        if(p.leaf){
+                            p.keys.push_back(node.keys[0]);
+                            p.keys.push_back(node.keys[node.count-1]);
+                        } else {
+                            p.keys.assign(node.keys, node.keys + node.count);
+                            p.children.assign(node.children, node.children + node.count + 1);
+                            for(int i = 0; COUNTED && i <= node.count; i++) p.sizes.push_back(node.size(i));
+                        }
+                    }
+                }
+            }
+
+            void fail(report &r, long id, const std::string &what) {
+                r.errors.push_back("page " + std::to_string(id) + ": " + what);
+            }
+
+            // Checks the scanned subtree at page `id`, whose keys must lie in
+            // [lo, hi] where given; returns its key count.
+            long verify_node(long id, int depth, const T *lo, const T *hi, bool right, verify_walk &w) {
+                if(id < w.first || id >= w.first + (long) w.info.size()){
+                    fail(w.r, id, "child id out of range");
+                    return 0;
+                }
+                pageinfo &p = w.info[id - w.first];
+                if(w.seen[id - w.first]){
+                    fail(w.r, id, "reached twice");
+                    return 0;
+                }
+                w.seen[id - w.first] = 1;
+                w.r.nodes++;
+                if(!p.intact){
+                    fail(w.r, id, "checksum mismatch");
+                    return 0;
+                }
+                if(p.count < 1 || p.count > BSTAR_ORDER-1){
+                    fail(w.r, id, std::to_string(p.count) + " keys");
+                    return 0;
+                }
+                if(p.count < F_BLOCK){
+                    if(right || w.tolerant) w.r.thin++;
+                    else fail(w.r, id, "underfull, " + std::to_string(p.count) + " keys");
+                }
+                if(!p.sorted) fail(w.r, id, "keys out of order");
+                if((lo && comp(p.keys.front(), *lo)) || (hi && comp(*hi, p.keys.back()))) fail(w.r, id, "keys outside the parent's range");
+                w.r.keys += p.count;
+                if(p.leaf){
+                    if(w.leaf_depth == -1) w.leaf_depth = depth;
+                    else if(w.leaf_depth != depth) fail(w.r, id, "leaf at depth " + std::to_string(depth));
+                    return p.count;
+                }
+                long total = p.count;
+                for(int i = 0; i <= p.count; i++){
+                    if(!p.children[i]){
+                        fail(w.r, id, "missing child " + std::to_string(i));
+                        continue;
+                    }
+                    long n = verify_node(p.children[i], depth + 1, i ? &p.keys[i-1] : lo,
+                                         i < p.count ? &p.keys[i] : hi, right && i == p.count, w);
+                    if(COUNTED && p.sizes[i] != n) fail(w.r, id, "size of child " + std::to_string(i) + " is off");
+                    total += n;
+                }
+                return total;
+            }
+
         public:
-            bstar(std::shared_ptr<pagemanager> pm) : pm{pm} {
+            bstar(std::shared_ptr<pagemanager> pm, const Compare &comp = Compare()) : pm{pm}, comp(comp) {
                 if (pm->is_empty()) {
                     Node<2*F_BLOCK> root{header.root_id};
-                    pm->save(root.page_id, root);
+                    write_node(root.page_id, root);
 
                     header.count++;
 
-                    pm->save(0, header);
+                    save_header();
                 } else {
-                    pm->recover(0, header);
+                    load_header();
+                    open_bloom();
                 }
             }
 
-            void insert(T k) {
+            // Opens (or creates) the index `name` inside a catalog file, sharing
+            // its pages, free list and page cache with the other indexes there.
+            bstar(std::shared_ptr<catalog> cat, const std::string &name, const Compare &comp = Compare()) :
+                pm{cat->pager()}, cat{cat}, comp(comp) {
+                if (pm->page_size() < (long) std::max(sizeof(Node<>), sizeof(Node<2*F_BLOCK>))) {
+                    throw std::invalid_argument("page size too small for this bstar order");
+                }
+                bool created;
+                header_id = cat->open(name, created);
+                if (created) {
+                    header.root_id = cat->allocate();
+                    Node<2*F_BLOCK> root{header.root_id};
+                    write_node(root.page_id, root);
+                    save_header();
+                } else {
+                    load_header();
+                    open_bloom();
+                }
+            }
+
+            ~bstar() {
+                if(header.bloom_bits && !header.bloom_clean && !bloom_stale) save_bloom();
+            }
+
+            void insert(const T &k) {
+                statistics::timer timer(pm->stats(), statistics::OP_INSERT);
+                pagemanager::batch batch(*pm);
+                ascending = comp(last_insert, k) ? ascending + 1 : 0;
+                last_insert = k;
+                if(ascending >= APPEND_RUN && append(k)){
+                    bloom_add(k);
+                    return;
+                }
+                spine.clear();
                 Node<2*F_BLOCK> root = read_root();
-                insert(k,root);
-                if(root.count > F_BLOCK*2){
-                    splitRoot(root);
+                if(insert(k,root)){
+                    if(root.count > F_BLOCK*2){
+                        splitRoot(root);
+                    }
+                    write_node(root.page_id, root);
                 }
-                write_node(root.page_id, root);
+                bloom_add(k);
             }
 
-            bool remove(T k) {
+            bool remove(const T &k) {
+                statistics::timer timer(pm->stats(), statistics::OP_REMOVE);
+                pagemanager::batch batch(*pm);
                 T *temp=0;
+                spine.clear();
                 Node<2*F_BLOCK> root = read_root();
-                return remove(k,temp,root);
+                bool removed = remove(k,temp,root);
+                if(removed) bloom_removed_one();
+                return removed;
+            }
+
+            Compare key_comp() const {
+                return comp;
+            }
+
+            // Copies the stored element equal to `key` into `out`.
+            bool lookup(const T &key, T &out) {
+                long page_id;
+                int slot;
+                if(bloom_rejects(key)) return false;
+                if(hot_capacity && probe_hot(key, out, page_id, slot)) return true;
+                if(!locate(key, page_id, slot)) return false;
+                if(page_id == header.root_id) out = read_root().keys[slot];
+                else out = read_node(page_id).keys[slot];
+                if(hot_capacity) warm(key, page_id);
+                return true;
+            }
+
+            // Replaces the stored element equal to `value` in place; the
+            // ordering of `value` must not differ from the one it replaces.
+            bool update(const T &value) {
+                long page_id;
+                int slot;
+                if(!locate(value, page_id, slot)) return false;
+                if(page_id == header.root_id){
+                    Node<2*F_BLOCK> root = read_root();
+                    root.keys[slot] = value;
+                    write_node(page_id, root);
+                } else {
+                    Node<> n = read_node(page_id);
+                    n.keys[slot] = value;
+                    write_node(page_id, n);
+                }
+                return true;
+            }
+
+            // Removes every key in [lo, hi]. Subtrees lying wholly inside the
+            // range go to the free list without their leaves being read; only
+            // the nodes on the two boundary paths are rewritten and rebalanced.
+            void delete_range(const T &lo, const T &hi) {
+                if(comp(hi, lo)) return;
+                statistics::timer timer(pm->stats(), statistics::OP_REMOVE);
+                pagemanager::batch batch(*pm);
+                spine.clear();
+                Node<2*F_BLOCK> root = read_root();
+                std::vector<long> freed;
+                bool held = false;
+                T hold;
+                if(!erase_range(root, height(), lo, hi, false, false, freed, held, hold)) return;
+                free_pages(freed);
+                repair_range(lo, hi);
+                if(held) remove(hold);
+                if(header.bloom_bits){
+                    bloom_touch();
+                    bloom_stale = true;
+                }
+            }
+
+            // Lets remove() leave nodes with as few as `floor` keys (at least
+            // one) instead of rotating or merging at once, so a burst of
+            // removes mostly costs one leaf write per key. Thin nodes are
+            // queued for compact(); the queue is not persisted. A floor of
+            // F_BLOCK or more restores eager rebalancing.
+            void defer_rebalance(int floor) {
+                relaxed = floor >= F_BLOCK ? 0 : std::max(1, floor);
+                if(!relaxed) compact();
+            }
+
+            // Refills the nodes thinned by deferred removes, pooling runs of
+            // siblings so several underfull nodes are fixed in one pass.
+            void compact() {
+                pagemanager::batch batch(*pm);
+                spine.clear();
+                while(collapse_root() || repair_thin(deferred));
+            }
+
+            std::size_t deferred_nodes() const { return deferred.size(); }
+
+            // Lets lookup() and find() remember up to `capacity` hot keys with
+            // the page holding each, so repeated lookups of a key cost one
+            // hash probe and one page read instead of a descent. An iterator
+            // find() places this way reads its path only once advanced. Kept
+            // in memory only.
+            void enable_hash_index(std::size_t capacity = 4096) {
+                hot_capacity = capacity;
+                if(!capacity) clear_hot();
+            }
+
+            void disable_hash_index() { enable_hash_index(0); }
+
+            std::size_t hash_index_size() const { return hot.size(); }
+
+            // Checks the index without chasing pointers on disk: `threads`
+            // workers read contiguous slices of the file sequentially, then
+            // the tree is walked in memory. Covers page checksums, key order
+            // within and across pages, fill (at most BSTAR_ORDER-1 keys; at
+            // least F_BLOCK except on the right edge or while removes are
+            // deferred; a root of at most 2*F_BLOCK), leaf depth, COUNTED
+            // sizes, pages reached twice, the header's page count and the
+            // free list, which must be acyclic and apart from the tree. In a
+            // legacy index every page must be in the tree or free.
+            report verify(unsigned threads = std::thread::hardware_concurrency()) {
+                report r;
+                long first = cat ? 1 : 3;
+                long last = cat ? cat->last_page() + 1 : header.count + 2;
+                long stride = cat ? pm->page_size() : (long) sizeof(Node<>);
+                std::vector<pageinfo> info(std::max(0L, last - first));
+                r.pages = info.size();
+
+                int fd = ::open(pm->file_name().c_str(), O_RDONLY);
+                if(fd < 0) throw std::runtime_error("cannot open " + pm->file_name());
+                threads = std::max(1u, threads);
+                long slice = (r.pages + threads - 1) / threads;
+                std::vector<std::exception_ptr> errors(threads);
+                auto work = [&](unsigned t) {
+                    try {
+                        long from = first + t * slice, to = std::min(last, from + slice);
+                        if(from < to) scan_pages(fd, from, to, stride, first, info);
+                    } catch(...) {
+                        errors[t] = std::current_exception();
+                    }
+                };
+                std::vector<std::thread> pool;
+                for(unsigned t = 1; t < threads; t++) pool.emplace_back(work, t);
+                work(0);
+                for(auto &t : pool) t.join();
+                ::close(fd);
+                for(auto &e : errors) if(e) std::rethrow_exception(e);
+
+                Node<2*F_BLOCK> root{-1};
+                pm->recover(header.root_id, root);
+                r.nodes = 1;
+                if(!root.intact()){
+                    fail(r, header.root_id, "checksum mismatch");
+                    return r;
+                }
+                if(root.count > 2*F_BLOCK) fail(r, header.root_id, std::to_string(root.count) + " keys in the root");
+                for(int i = 1; i < root.count; i++) if(comp(root.keys[i], root.keys[i-1])) fail(r, header.root_id, "keys out of order");
+                r.keys = root.count;
+
+                verify_walk w{r, info, std::vector<char>(info.size(), 0), first, -1, relaxed || !deferred.empty()};
+                if(root.children[0]){
+                    for(int i = 0; i <= root.count; i++){
+                        long n = verify_node(root.children[i], 1, i ? &root.keys[i-1] : 0,
+                                             i < root.count ? &root.keys[i] : 0, i == root.count, w);
+                        if(COUNTED && root.size(i) != n) fail(r, header.root_id, "size of child " + std::to_string(i) + " is off");
+                    }
+                }
+                if(r.nodes - 1 != header.size){
+                    r.errors.push_back("header counts " + std::to_string(header.size) + " pages, the tree has " +
+                                       std::to_string(r.nodes - 1));
+                }
+
+                long steps = 0;
+                for(long id = cat ? cat->free_head() : header.erase; id != -1; id = info[id - first].link){
+                    if(id < first || id >= last){
+                        fail(r, id, "free list leaves the file");
+                        break;
+                    }
+                    if(w.seen[id - first] == 1){
+                        fail(r, id, "both in the tree and on the free list");
+                        break;
+                    }
+                    if(w.seen[id - first] == 2 || ++steps > r.pages){
+                        fail(r, id, "free list loops");
+                        break;
+                    }
+                    if(!cat && !info[id - first].intact) fail(r, id, "checksum mismatch");
+                    w.seen[id - first] = 2;
+                    r.free++;
+                }
+                for(long id = first; !cat && id < last; id++){
+                    if(!w.seen[id - first]) fail(r, id, "neither in the tree nor free");
+                }
+                return r;
+            }
+
+            // Empties the tree. A legacy index rewinds its page counter, so
+            // only the root is written; in a catalog every page is released.
+            void clear() {
+                pagemanager::batch batch(*pm);
+                spine.clear();
+                Node<2*F_BLOCK> root = read_root();
+                if(cat){
+                    std::vector<long> ids;
+                    int h = height();
+                    for(int i=0; root.children[0] && i<=root.count; i++) subtree_pages(root.children[i], h - 1, ids);
+                    free_pages(ids);
+                } else {
+                    header.count = 1;
+                    header.erase = -1;
+                    header.size = 0;
+                }
+                Node<2*F_BLOCK> empty{header.root_id};
+                write_node(empty.page_id, empty);
+                save_header();
+                deferred.clear();
+                clear_hot();
+                if(header.bloom_bits){
+                    bloom_touch();
+                    bloom_stale = true;
+                }
             }
 
             iterator find(const T &key) {
-                iterator it(this->pm);
+                statistics::timer timer(pm->stats(), statistics::OP_FIND);
+                iterator it(this->pm, header.root_id, comp);
+                if(bloom_rejects(key)) return it;
+                if(hot_capacity){
+                    T out;
+                    long page_id;
+                    int slot;
+                    if(probe_hot(key, out, page_id, slot)){
+                        it.place(page_id, slot);
+                        return it;
+                    }
+                }
                 it.find(key);
+                if(hot_capacity && it.page() != -1) warm(key, it.page());
                 return it;
             }
 
+            // Keeps a blocked Bloom filter with `bits_per_key` bits per key
+            // (10 gives about 1% false positives) that find() and lookup()
+            // consult before reading any page. It is persisted with the index.
+            void enable_bloom(int bits_per_key = 10) {
+                header.bloom_bits = bits_per_key;
+                header.bloom_clean = 0;
+                save_header();
+                rebuild_bloom();
+            }
+
+            void disable_bloom() {
+                if(cat) free_bloom_pages();
+                header.bloom_bits = 0;
+                header.bloom_clean = 0;
+                save_header();
+                bloom = bloomfilter();
+            }
+
+            // Writes the filter out; the destructor does so as well.
+            void save_bloom() {
+                if(!header.bloom_bits) return;
+                if(bloom_stale) rebuild_bloom();
+                store_bloom(bloom.serialize());
+                header.bloom_clean = 1;
+                save_header();
+            }
+
+            // Fills an empty tree with the `n` keys produced in ascending
+            // order by next(T &), writing every page once, bottom-up. Each
+            // page gets about `fill` of BSTAR_ORDER-1 keys, never fewer than
+            // the F_BLOCK a B* node needs.
+            template <class Source>
+            void bulk_load(Source next, long n, double fill = 1.0) {
+                pagemanager::batch batch(*pm);
+                Node<2*F_BLOCK> root = read_root();
+                if(root.count || root.children[0]){
+                    throw std::logic_error("bulk_load needs an empty tree");
+                }
+                spine.clear();
+                long target = std::max<long>(F_BLOCK, std::min<long>(BSTAR_ORDER - 1, fill * (BSTAR_ORDER - 1)));
+
+                std::vector<loadlevel> levels;
+                for(long keys = n; keys > 2*F_BLOCK; ){
+                    loadlevel l;
+                    l.keys = keys;
+                    l.nodes = plan_nodes(keys, target);
+                    l.index = 0;
+                    l.cur = Node<>(new_node().page_id);
+                    if(!levels.empty()) l.cur.children[0] = levels.back().cur.page_id;
+                    levels.push_back(l);
+                    keys = l.nodes - 1;
+                }
+                if(!levels.empty()) root.children[0] = levels.back().cur.page_id;
+
+                T key, last;
+                for(long i = 0; i < n; i++){
+                    if(!next(key)) throw std::invalid_argument("bulk_load source ended early");
+                    if(i && comp(key, last)) throw std::invalid_argument("bulk_load keys are not sorted");
+                    load_push(levels, root, 0, key, 0, 0);
+                    last = key;
+                }
+                for(std::size_t k = 0; k < levels.size(); k++){
+                    Node<> &cur = levels[k].cur;
+                    long total = cur.total();
+                    write_node(cur.page_id, cur);
+                    if(k + 1 < levels.size()) levels[k + 1].cur.set_size(levels[k + 1].cur.count, total);
+                    else root.set_size(root.count, total);
+                }
+                write_node(root.page_id, root);
+                if(header.bloom_bits){
+                    bloom_touch();
+                    bloom_stale = true;
+                }
+            }
+
+            void bulk_load(const std::vector<T> &keys, double fill = 1.0) {
+                std::size_t i = 0;
+                bulk_load([&](T &out) {
+                    if(i == keys.size()) return false;
+                    out = keys[i++];
+                    return true;
+                }, keys.size(), fill);
+            }
+
+            // Writes every key in order to `path` as a block stream (see
+            // blockstream.h), delta-encoded when `delta` is set and the keys
+            // are integers. Returns the number of keys written.
+            long export_keys(const std::string &path, bool delta = true, std::size_t block_size = 1 << 16) {
+                blockwriter<T> out(path, delta, block_size);
+                Node<2*F_BLOCK> root = read_root();
+                auto add = [&](const T &key) { out.add(key); };
+                walk(root, add);
+                return out.finish();
+            }
+
+            // Fills an empty tree from a block stream written by
+            // export_keys(), streaming it into bulk_load(). Returns the
+            // number of keys read.
+            long import_keys(const std::string &path, double fill = 1.0) {
+                blockreader<T> in(path);
+                bulk_load([&](T &out) { return in.next(out); }, in.count(), fill);
+                return in.count();
+            }
+
+            // Calls visitor(key) for every key in [lo, hi] in order.
+            template <class Visitor>
+            void scan(const T &lo, const T &hi, Visitor &visitor) {
+                Node<2*F_BLOCK> root = read_root();
+                scan_node(root, &lo, hi, true, visitor);
+            }
+
+            // Splits [lo, hi] at separator keys of the upper levels into up to
+            // `threads` disjoint sub-ranges of similar size and scans each on
+            // its own thread with its own copy of `visitor`. The copies are
+            // returned in key order for the caller to combine. The tree must
+            // not be modified meanwhile.
+            template <class Visitor>
+            std::vector<Visitor> parallel_scan(const T &lo, const T &hi, unsigned threads, Visitor visitor) {
+                Node<2*F_BLOCK> root = read_root();
+                std::vector<T> keys;
+                threads = std::max(1u, threads);
+                for(int depth = 1; depth <= 3 && keys.size() + 1 < threads * 4; depth++){
+                    keys.clear();
+                    separators(root, lo, hi, depth, keys);
+                    if(!root.children[0]) break;
+                }
+                keys.erase(std::unique(keys.begin(), keys.end(), [this](const T &a, const T &b) { return same(a, b); }),
+                           keys.end());
+
+                std::vector<T> cuts;
+                std::size_t parts = std::min<std::size_t>(threads, keys.size() + 1);
+                for(std::size_t p = 1; p < parts; p++) cuts.push_back(keys[p * (keys.size() + 1) / parts - 1]);
+
+                std::vector<Visitor> partial(cuts.size() + 1, visitor);
+                std::vector<std::exception_ptr> errors(partial.size());
+                auto work = [&](std::size_t p) {
+                    try {
+                        Node<2*F_BLOCK> r = read_root();
+                        const T &from = p ? cuts[p-1] : lo;
+                        if(p < cuts.size()) scan_node(r, &from, cuts[p], false, partial[p]);
+                        else scan_node(r, &from, hi, true, partial[p]);
+                    } catch(...) {
+                        errors[p] = std::current_exception();
+                    }
+                };
+                std::vector<std::thread> pool;
+                for(std::size_t p = 1; p < partial.size(); p++) pool.emplace_back(work, p);
+                work(0);
+                for(auto &t : pool) t.join();
+                for(auto &e : errors) if(e) std::rethrow_exception(e);
+                return partial;
+            }
+
+            // Number of keys smaller than `key`.
+            long rank(const T &key) {
+                return rank_of(key, false);
+            }
+
+            // Copies the k-th smallest key (from 0) into `out`.
+            bool select(long k, T &out) {
+                static_assert(COUNTED, "select needs a bstar with COUNTED set");
+                Node<2*F_BLOCK> root = read_root();
+                if(k < 0 || k >= root.total()) return false;
+                long id = select_step(root, k, out);
+                while(id){
+                    Node<> n = read_node(id);
+                    id = select_step(n, k, out);
+                }
+                return true;
+            }
+
+            // Number of keys in [lo, hi].
+            long count_range(const T &lo, const T &hi) {
+                if(comp(hi, lo)) return 0;
+                return rank_of(hi, true) - rank_of(lo, false);
+            }
+
+            long size() {
+                static_assert(COUNTED, "size needs a bstar with COUNTED set");
+                return read_root().total();
+            }
+
             iterator begin() {
-                iterator it(this->pm, header.root_id);
+                iterator it(this->pm, header.root_id, comp);
+                it.first();
+                return it;
+            }
+
+            // Iterator on the first key not below `key`.
+            iterator lower_bound(const T &key) {
+                iterator it(this->pm, header.root_id, comp);
+                it.seek(key);
                 return it;
             }
 
             iterator end() {
-                iterator it(this->pm);
+                iterator it(this->pm, header.root_id, comp);
                 return it;
             }
 
+            statistics &stats() { return pm->stats(); }
+
             void dfs() {
                 Node<2*F_BLOCK> root = read_root();
                 dfs(root);
@@ -744,6 +2528,54 @@ namespace utec {
                 print(root, 0, out);
             }
 
+            // Moves at most `budget` pages so that the non-root pages end up in
+            // level order starting at the first id new_node hands out (3).
+            // Inside a catalog file the tree only permutes the pages it already
+            // owns, in ascending id order. Every call rescans the inner levels,
+            // so it can be resumed after any insert/remove. Returns true once
+            // the layout is complete. Open iterators are invalidated.
+            bool reorganize(long budget = 1024) {
+                pagemanager::batch batch(*pm);
+                spine.clear();
+                std::vector<long> pages, parent;
+                scan_layout(pages, parent);
+
+                std::vector<long> target(pages);
+                if(cat) std::sort(target.begin(), target.end());
+                else for(std::size_t k=0; k<target.size(); k++) target[k] = k + 3;
+
+                std::unordered_map<long, long> pos;
+                for(std::size_t k=0; k<pages.size(); k++) pos[pages[k]] = k;
+
+                for(std::size_t k=0; k<pages.size(); k++){
+                    long a = pages[k], t = target[k];
+                    if(a == t) continue;
+                    if(budget-- <= 0) return false;
+
+                    long j = pos.count(t) ? pos[t] : -1;
+                    Node<> na = read_node(a);
+                    Node<> nt = read_node(t);
+                    if(j == -1) unlink_free(t, a);
+                    na.page_id = t;
+                    nt.page_id = a;
+                    write_node(t, na);
+                    write_node(a, nt);
+
+                    pages[k] = t;
+                    pos[t] = k;
+                    pos[a] = j;
+                    if(j != -1) pages[j] = a;
+
+                    long pk = parent[k] == -1 ? header.root_id : pages[parent[k]];
+                    exchange(pk, a, t);
+                    if(j != -1 && parent[j] != parent[k]){
+                        long pj = parent[j] == -1 ? header.root_id : pages[parent[j]];
+                        exchange(pj, a, t);
+                    }
+                }
+                return true;
+            }
+
         };
 
     } // namespace disk
@@ -0,0 +1,241 @@
+#pragma once
+
+#include "bstar.h"
+#include "catalog.h"
+#include "pagemanager.h"
+#include "../memory/bstar.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace utec {
+
+    namespace disk {
+
+        // A buffered write: the key, or a tombstone hiding it on disk.
+        template <class T>
+        struct memtable_entry {
+            T key;
+            bool tombstone;
+        };
+
+        template <class T>
+        bool operator<(const memtable_entry<T> &a, const memtable_entry<T> &b) { return a.key < b.key; }
+
+        template <class T>
+        bool operator<=(const memtable_entry<T> &a, const memtable_entry<T> &b) { return !(b.key < a.key); }
+
+        template <class T>
+        bool operator==(const memtable_entry<T> &a, const memtable_entry<T> &b) { return a.key == b.key; }
+
+        template <class T>
+        bool operator!=(const memtable_entry<T> &a, const memtable_entry<T> &b) { return !(a.key == b.key); }
+
+        // Set of keys whose writes land in an in-memory bstar (the memtable)
+        // first. Once the memtable holds about `memory_limit` bytes it is
+        // frozen and merged into the disk bstar in key order, so the disk tree
+        // only sees sorted batches and consecutive writes reuse the same
+        // pages. Reads and iteration consult the memtable before the disk.
+        //
+        // Buffered writes are lost if the process dies before flush(); the
+        // destructor flushes too, but drops any error doing so, so call
+        // flush() to learn whether they reached the disk. Any write
+        // invalidates open iterators.
+        template <class T, int BSTAR_ORDER = 3, int MEMTABLE_ORDER = 31>
+        class buffered_bstar {
+        public:
+            typedef bstar<T, BSTAR_ORDER> tree_type;
+            typedef memtable_entry<T> entry;
+            typedef memory::bstar<entry, MEMTABLE_ORDER> memtable_type;
+
+            // Walks the memtable snapshot and the disk tree side by side; a
+            // buffered entry shadows the disk key it equals.
+            class iterator {
+            public:
+                T operator*() { return current; }
+
+                iterator &operator++() {
+                    advance();
+                    return *this;
+                }
+
+                bool operator==(const iterator &other) {
+                    if (done || other.done) return done == other.done;
+                    return current == other.current;
+                }
+
+                bool operator!=(const iterator &other) { return !(*this == other); }
+
+            private:
+                friend class buffered_bstar;
+
+                std::shared_ptr<std::vector<entry>> buffered;
+                std::size_t pos = 0;
+                typename tree_type::iterator disk, disk_end;
+                bool on_disk = false;
+                T disk_key;
+                T current;
+                bool done = true;
+
+                iterator(std::shared_ptr<std::vector<entry>> buffered, typename tree_type::iterator disk,
+                         typename tree_type::iterator disk_end) :
+                    buffered(buffered), disk(disk), disk_end(disk_end) {
+                    done = false;
+                    next_disk();
+                    advance();
+                }
+
+                explicit iterator(typename tree_type::iterator end) : disk(end), disk_end(end) {}
+
+                void next_disk() {
+                    on_disk = disk != disk_end;
+                    if (on_disk) disk_key = *disk;
+                }
+
+                void advance() {
+                    while (true) {
+                        bool in_memory = pos < buffered->size();
+                        if (!in_memory && !on_disk) {
+                            done = true;
+                            return;
+                        }
+                        if (in_memory && (!on_disk || !(disk_key < (*buffered)[pos].key))) {
+                            const entry &e = (*buffered)[pos++];
+                            if (on_disk && disk_key == e.key) {
+                                ++disk;
+                                next_disk();
+                            }
+                            if (e.tombstone) continue;
+                            current = e.key;
+                            return;
+                        }
+                        current = disk_key;
+                        ++disk;
+                        next_disk();
+                        return;
+                    }
+                }
+            };
+
+            buffered_bstar(std::shared_ptr<pagemanager> pm, std::size_t memory_limit = std::size_t(64) << 20) :
+                disk(pm), limit(memory_limit), active(new memtable_type) {}
+
+            buffered_bstar(std::shared_ptr<catalog> cat, const std::string &name,
+                           std::size_t memory_limit = std::size_t(64) << 20) :
+                disk(cat, name), limit(memory_limit), active(new memtable_type) {}
+
+            ~buffered_bstar() {
+                try {
+                    flush();
+                } catch (...) {
+                }
+            }
+
+            void insert(const T &key) { put(entry{key, false}); }
+
+            // Records a tombstone; whether the key existed is only known once
+            // it reaches the disk tree.
+            void remove(const T &key) { put(entry{key, true}); }
+
+            bool contains(const T &key) {
+                entry e;
+                if (active->lookup(entry{key, false}, e)) return !e.tombstone;
+                if (frozen && frozen->lookup(entry{key, false}, e)) return !e.tombstone;
+                return disk.find(key) != disk.end();
+            }
+
+            // Freezes the memtable and merges it into the disk tree. A frozen
+            // memtable left by a failed merge is merged first.
+            void flush() {
+                if (frozen) merge();
+                if (!entries) return;
+                frozen.swap(active);
+                frozen_entries = entries;
+                active.reset(new memtable_type);
+                entries = 0;
+                merge();
+            }
+
+            // Buffered entries, tombstones included.
+            std::size_t buffered() const { return entries + frozen_entries; }
+
+            // Approximate bytes held by the memtables.
+            std::size_t memory_usage() const { return buffered() * (sizeof(entry) + sizeof(void *)); }
+
+            tree_type &tree() { return disk; }
+
+            iterator begin() {
+                return iterator(snapshot(), disk.begin(), disk.end());
+            }
+
+            iterator end() {
+                return iterator(disk.end());
+            }
+
+        private:
+            tree_type disk;
+            std::size_t limit;
+            std::unique_ptr<memtable_type> active;
+            std::unique_ptr<memtable_type> frozen;
+            std::size_t entries = 0;
+            std::size_t frozen_entries = 0;
+
+            void put(const entry &e) {
+                if (!active->update(e)) {
+                    active->insert(e);
+                    entries++;
+                }
+                if (memory_usage() >= limit) flush();
+            }
+
+            // Applies the frozen memtable to the disk tree in ascending key
+            // order; an empty disk tree is bulk loaded instead.
+            void merge() {
+                std::vector<entry> batch;
+                batch.reserve(frozen_entries);
+                frozen->for_each([&batch](const entry &e) { batch.push_back(e); });
+                if (disk.begin() == disk.end()) {
+                    std::vector<T> keys;
+                    keys.reserve(batch.size());
+                    for (const entry &e : batch) {
+                        if (!e.tombstone) keys.push_back(e.key);
+                    }
+                    if (!keys.empty()) disk.bulk_load(keys);
+                } else {
+                    T found;
+                    for (const entry &e : batch) {
+                        if (e.tombstone) disk.remove(e.key);
+                        else if (!disk.lookup(e.key, found)) disk.insert(e.key);
+                    }
+                }
+                frozen.reset();
+                frozen_entries = 0;
+            }
+
+            // Sorted copy of the buffered entries, the active memtable
+            // shadowing the frozen one.
+            std::shared_ptr<std::vector<entry>> snapshot() {
+                std::shared_ptr<std::vector<entry>> out(new std::vector<entry>);
+                out->reserve(buffered());
+                active->for_each([&out](const entry &e) { out->push_back(e); });
+                if (frozen) {
+                    std::vector<entry> older, merged;
+                    frozen->for_each([&older](const entry &e) { older.push_back(e); });
+                    std::size_t i = 0, j = 0;
+                    while (i < out->size() || j < older.size()) {
+                        if (j == older.size() || (i < out->size() && !(older[j] < (*out)[i]))) {
+                            if (j < older.size() && older[j] == (*out)[i]) j++;
+                            merged.push_back((*out)[i++]);
+                        } else {
+                            merged.push_back(older[j++]);
+                        }
+                    }
+                    out->swap(merged);
+                }
+                return out;
+            }
+        };
+
+    } // namespace disk
+
+} // namespace utec
@@ -0,0 +1,367 @@
+#pragma once
+
+#include "bstar.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace utec {
+
+    namespace disk {
+
+        // Builds a disk bstar from an unsorted text file of whitespace
+        // separated numbers with an external sort:
+        //
+        //   1. the file is cut into chunks that `threads` workers read and
+        //      parse in parallel;
+        //   2. each worker sorts its share of the memory budget and spills
+        //      it as a run once it is full;
+        //   3. runs are merged k ways, in several passes if there are more
+        //      runs than read buffers fit in the budget;
+        //   4. the merged stream goes to bstar::bulk_load, which writes
+        //      every page once.
+        template <class T>
+        class indexbuilder {
+        public:
+            struct options {
+                std::size_t memory_budget = std::size_t(256) << 20;
+                std::size_t chunk_size = std::size_t(16) << 20;
+                unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+                std::string temp_dir = ".";
+                double fill = 1.0;
+            };
+
+            indexbuilder(options opt = options()) : opt(opt) {}
+
+            ~indexbuilder() {
+                for (auto &run : runs) ::unlink(run.path.c_str());
+            }
+
+            // Loads every key of `input` into the empty `tree`; returns the
+            // number of keys.
+            template <int BSTAR_ORDER, bool COUNTED>
+            long build(const std::string &input, bstar<T, BSTAR_ORDER, COUNTED> &tree) {
+                sort(input);
+                long n = total;
+                if (runs.empty()) {
+                    tree.bulk_load(memory, opt.fill);
+                } else {
+                    merge_passes();
+                    merger m(*this, 0, runs.size());
+                    tree.bulk_load([&m](T &out) { return m.next(out); }, n, opt.fill);
+                }
+                clear();
+                return n;
+            }
+
+            // Number of sorted runs written by the last build, before merging.
+            std::size_t spilled() const { return spilled_runs; }
+
+        private:
+            struct run {
+                std::string path;
+                long count;
+            };
+
+            // Sequential reader of one run with its own buffer.
+            class runreader {
+            public:
+                runreader(const run &r, std::size_t buffer) : left(r.count), buf(std::max<std::size_t>(buffer, 1)) {
+                    fd = ::open(r.path.c_str(), O_RDONLY);
+                    if (fd < 0) throw std::runtime_error("cannot open run " + r.path);
+#ifdef POSIX_FADV_SEQUENTIAL
+                    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+                }
+
+                ~runreader() { ::close(fd); }
+
+                bool next(T &out) {
+                    if (pos == end) {
+                        if (!left) return false;
+                        std::size_t want = std::min<std::size_t>(buf.size(), left);
+                        if (!read_all(fd, buf.data(), want * sizeof(T))) throw std::runtime_error("short read on run");
+                        pos = 0;
+                        end = want;
+                        left -= want;
+                    }
+                    out = buf[pos++];
+                    return true;
+                }
+
+            private:
+                int fd;
+                long left;
+                std::size_t pos = 0, end = 0;
+                std::vector<T> buf;
+            };
+
+            // Merges runs [first, last) through a min-heap of run heads.
+            class merger {
+            public:
+                merger(indexbuilder &b, std::size_t first, std::size_t last) {
+                    std::size_t k = last - first;
+                    std::size_t buffer = b.opt.memory_budget / sizeof(T) / (k + 1);
+                    for (std::size_t i = first; i < last; i++) {
+                        readers.emplace_back(new runreader(b.runs[i], buffer));
+                        T key;
+                        if (readers.back()->next(key)) heap.push(std::make_pair(key, readers.size() - 1));
+                    }
+                }
+
+                bool next(T &out) {
+                    if (heap.empty()) return false;
+                    std::pair<T, std::size_t> top = heap.top();
+                    heap.pop();
+                    out = top.first;
+                    T key;
+                    if (readers[top.second]->next(key)) heap.push(std::make_pair(key, top.second));
+                    return true;
+                }
+
+            private:
+                typedef std::pair<T, std::size_t> head;
+
+                struct later {
+                    bool operator()(const head &a, const head &b) const { return b.first < a.first; }
+                };
+
+                std::vector<std::unique_ptr<runreader>> readers;
+                std::priority_queue<head, std::vector<head>, later> heap;
+            };
+
+            options opt;
+            std::vector<run> runs;
+            std::vector<T> memory;
+            std::mutex runs_mutex;
+            std::atomic<long> next_run{0};
+            long total = 0;
+            std::size_t spilled_runs = 0;
+
+            static bool read_all(int fd, void *data, std::size_t size) {
+                char *p = static_cast<char *>(data);
+                while (size) {
+                    ssize_t r = ::read(fd, p, size);
+                    if (r <= 0) return false;
+                    p += r;
+                    size -= r;
+                }
+                return true;
+            }
+
+            static bool write_all(int fd, const void *data, std::size_t size) {
+                const char *p = static_cast<const char *>(data);
+                while (size) {
+                    ssize_t w = ::write(fd, p, size);
+                    if (w <= 0) return false;
+                    p += w;
+                    size -= w;
+                }
+                return true;
+            }
+
+            static T parse(const char *begin, char **end, std::true_type) {
+                return (T) std::strtoll(begin, end, 10);
+            }
+
+            static T parse(const char *begin, char **end, std::false_type) {
+                return (T) std::strtod(begin, end);
+            }
+
+            static bool space(char c) {
+                return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+            }
+
+            std::string run_path() {
+                return opt.temp_dir + "/bstar-run-" + std::to_string(::getpid()) + "-" +
+                       std::to_string(next_run++);
+            }
+
+            run spill(const T *data, std::size_t count) {
+                run r{run_path(), (long) count};
+                int fd = ::open(r.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd < 0 || !write_all(fd, data, count * sizeof(T))) {
+                    if (fd >= 0) ::close(fd);
+                    throw std::runtime_error("cannot write run " + r.path);
+                }
+                ::close(fd);
+                return r;
+            }
+
+            // Parses the tokens that start inside [begin, end) of the file.
+            // A token crossing `end` is read to its last digit.
+            template <class Emit>
+            void parse_chunk(int fd, long begin, long end, long size, Emit emit) {
+                long from = begin > 0 ? begin - 1 : 0;
+                long limit = end;
+                std::vector<char> text;
+                while (true) {
+                    text.resize(limit - from + 1);
+                    ssize_t got = ::pread(fd, text.data(), limit - from, from);
+                    if (got < 0) throw std::runtime_error("cannot read input");
+                    text.resize(got);
+                    if (limit >= size || (!text.empty() && space(text.back()))) break;
+                    limit = std::min(size, limit + 64);
+                }
+                text.push_back('\0');
+
+                const char *p = text.data();
+                const char *stop = text.data() + (end - from);
+                // Skip a token that began in the previous chunk.
+                if (begin > 0) {
+                    if (!space(*p)) {
+                        while (*p && !space(*p)) p++;
+                    }
+                }
+                while (true) {
+                    while (*p && space(*p)) p++;
+                    if (!*p || p >= stop) break;
+                    char *after;
+                    T key = parse(p, &after, std::integral_constant<bool, std::is_integral<T>::value>());
+                    if (after == p) throw std::invalid_argument("bad key in input near offset " +
+                                                                std::to_string(from + (p - text.data())));
+                    emit(key);
+                    p = after;
+                }
+            }
+
+            // Steps 1 and 2: every worker parses chunks into its own buffer
+            // and spills it as a sorted run when its share of the budget is
+            // used up. Small inputs stay in memory.
+            void sort(const std::string &input) {
+                clear();
+                int fd = ::open(input.c_str(), O_RDONLY);
+                if (fd < 0) throw std::runtime_error("cannot open " + input);
+                struct stat st;
+                fstat(fd, &st);
+                long size = st.st_size;
+                long chunks = std::max<long>(1, (size + opt.chunk_size - 1) / opt.chunk_size);
+                unsigned threads = std::max(1u, opt.threads);
+                std::size_t share = std::max<std::size_t>(1024, opt.memory_budget / sizeof(T) / threads);
+
+                std::atomic<long> next_chunk(0);
+                std::vector<std::vector<T>> leftovers(threads);
+                std::vector<std::exception_ptr> errors(threads);
+                std::atomic<long> keys(0);
+
+                auto worker = [&](unsigned id) {
+                    try {
+                        std::vector<T> buffer;
+                        buffer.reserve(std::min<std::size_t>(share, 1 << 20));
+                        for (long c = next_chunk++; c < chunks; c = next_chunk++) {
+                            parse_chunk(fd, c * opt.chunk_size, std::min<long>(size, (c + 1) * opt.chunk_size), size,
+                                        [&](const T &key) {
+                                buffer.push_back(key);
+                                keys++;
+                                if (buffer.size() == share) {
+                                    std::sort(buffer.begin(), buffer.end());
+                                    run r = spill(buffer.data(), buffer.size());
+                                    buffer.clear();
+                                    std::lock_guard<std::mutex> lock(runs_mutex);
+                                    runs.push_back(r);
+                                }
+                            });
+                        }
+                        std::sort(buffer.begin(), buffer.end());
+                        leftovers[id].swap(buffer);
+                    } catch (...) {
+                        errors[id] = std::current_exception();
+                    }
+                };
+                std::vector<std::thread> pool;
+                for (unsigned t = 1; t < threads; t++) pool.emplace_back(worker, t);
+                worker(0);
+                for (auto &t : pool) t.join();
+                ::close(fd);
+                for (auto &e : errors) {
+                    if (e) std::rethrow_exception(e);
+                }
+
+                total = keys;
+                if (runs.empty()) {
+                    // Everything fit: merge the sorted leftovers in memory.
+                    for (auto &part : leftovers) {
+                        std::size_t middle = memory.size();
+                        memory.insert(memory.end(), part.begin(), part.end());
+                        std::inplace_merge(memory.begin(), memory.begin() + middle, memory.end());
+                    }
+                } else {
+                    for (auto &part : leftovers) {
+                        if (!part.empty()) runs.push_back(spill(part.data(), part.size()));
+                    }
+                }
+                spilled_runs = runs.size();
+            }
+
+            // Step 3: while more runs exist than the budget can give a
+            // reasonable buffer each, merge groups of them into longer runs.
+            void merge_passes() {
+                std::size_t fan_in = std::max<std::size_t>(2, opt.memory_budget / sizeof(T) / 4096);
+                while (runs.size() > fan_in) {
+                    std::vector<run> merged;
+                    for (std::size_t first = 0; first < runs.size(); first += fan_in) {
+                        std::size_t last = std::min(runs.size(), first + fan_in);
+                        if (last - first == 1) {
+                            merged.push_back(runs[first]);
+                            continue;
+                        }
+                        run out{run_path(), 0};
+                        {
+                            merger m(*this, first, last);
+                            int fd = ::open(out.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                            if (fd < 0) throw std::runtime_error("cannot write run " + out.path);
+                            std::vector<T> buf;
+                            buf.reserve(4096);
+                            auto put = [&]() {
+                                if (!write_all(fd, buf.data(), buf.size() * sizeof(T))) {
+                                    ::close(fd);
+                                    ::unlink(out.path.c_str());
+                                    throw std::runtime_error("cannot write run " + out.path);
+                                }
+                                out.count += buf.size();
+                                buf.clear();
+                            };
+                            T key;
+                            while (m.next(key)) {
+                                buf.push_back(key);
+                                if (buf.size() == buf.capacity()) put();
+                            }
+                            put();
+                            ::close(fd);
+                        }
+                        for (std::size_t i = first; i < last; i++) ::unlink(runs[i].path.c_str());
+                        merged.push_back(out);
+                    }
+                    runs.swap(merged);
+                }
+            }
+
+            void clear() {
+                for (auto &run : runs) ::unlink(run.path.c_str());
+                runs.clear();
+                memory.clear();
+                total = 0;
+            }
+        };
+
+    } // namespace disk
+
+} // namespace utec
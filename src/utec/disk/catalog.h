@@ -0,0 +1,216 @@
+#pragma once
+
+#include "pagemanager.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace utec {
+
+    namespace disk {
+
+        // Directory of named indexes stored in one fixed-page-size file.
+        // Page 0 holds the catalog header followed by as many entries as fit;
+        // further entries spill into a chain of catalog pages. Every index
+        // sharing the file allocates pages from the single free list kept here.
+        class catalog {
+        public:
+            enum {
+                NAME_SIZE = 48,
+            };
+
+            catalog(std::shared_ptr<pagemanager> pm) : pm{pm} {
+                long page_size = pm->page_size();
+                if (page_size < (long) (sizeof(header) + sizeof(entry))) {
+                    throw std::invalid_argument("catalog needs a pagemanager with a page size");
+                }
+                std::memset(&head, 0, sizeof(head));
+                pm->recover_bytes(0, &head, sizeof(head));
+                if (std::memcmp(head.magic, magic(), sizeof(head.magic)) == 0) {
+                    load();
+                    if (head.page_size != page_size) {
+                        throw std::invalid_argument("catalog was created with another page size");
+                    }
+                } else if (pm->is_empty()) {
+                    std::memcpy(head.magic, magic(), sizeof(head.magic));
+                    head.page_size = page_size;
+                    head.count = 0;
+                    head.erase = -1;
+                    head.entries = 0;
+                    head.next = -1;
+                    chain.push_back(0);
+                    flush();
+                } else {
+                    throw std::invalid_argument("file is not a catalog");
+                }
+            }
+
+            // Page holding the header of index `name`; the page is allocated
+            // and `created` set when the index did not exist yet.
+            long open(const std::string &name, bool &created) {
+                std::lock_guard<std::mutex> lock(mutex);
+                created = false;
+                for (auto &e : entries) {
+                    if (name == e.name) return e.page;
+                }
+                if (name.size() >= NAME_SIZE) {
+                    throw std::invalid_argument("index name too long: " + name);
+                }
+                entry e;
+                std::memset(&e, 0, sizeof(e));
+                std::strncpy(e.name, name.c_str(), NAME_SIZE - 1);
+                e.page = allocate_page();
+                entries.push_back(e);
+                head.entries = entries.size();
+                flush();
+                created = true;
+                return e.page;
+            }
+
+            bool contains(const std::string &name) {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (auto &e : entries) {
+                    if (name == e.name) return true;
+                }
+                return false;
+            }
+
+            std::vector<std::string> names() {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::vector<std::string> out;
+                for (auto &e : entries) out.push_back(e.name);
+                return out;
+            }
+
+            long allocate() {
+                std::lock_guard<std::mutex> lock(mutex);
+                long id = allocate_page();
+                save_header();
+                return id;
+            }
+
+            void release(long page_id) {
+                std::lock_guard<std::mutex> lock(mutex);
+                freepage f{head.erase};
+                pm->save_bytes(page_id, &f, sizeof(f));
+                head.erase = page_id;
+                save_header();
+            }
+
+            std::shared_ptr<pagemanager> pager() { return pm; }
+
+            // Highest page id handed out so far.
+            long last_page() {
+                std::lock_guard<std::mutex> lock(mutex);
+                return head.count;
+            }
+
+            // First released page, or -1; each one starts with the next id.
+            long free_head() {
+                std::lock_guard<std::mutex> lock(mutex);
+                return head.erase;
+            }
+
+        private:
+            static const char *magic() { return "BSTARCAT"; }
+
+            struct header {
+                char magic[8];
+                long page_size;
+                long count;
+                long erase;
+                long entries;
+                long next;
+            };
+
+            struct entry {
+                char name[NAME_SIZE];
+                long page;
+            };
+
+            struct freepage {
+                long next;
+            };
+
+            std::shared_ptr<pagemanager> pm;
+            std::mutex mutex;
+            header head;
+            std::vector<entry> entries;
+            std::vector<long> chain;
+
+            long allocate_page() {
+                if (head.erase == -1) return ++head.count;
+                long id = head.erase;
+                freepage f;
+                pm->recover_bytes(id, &f, sizeof(f));
+                head.erase = f.next;
+                return id;
+            }
+
+            std::size_t first_capacity() {
+                return (head.page_size - sizeof(header)) / sizeof(entry);
+            }
+
+            std::size_t chain_capacity() {
+                return (head.page_size - sizeof(long)) / sizeof(entry);
+            }
+
+            void save_header() {
+                pm->save_bytes(0, &head, sizeof(head));
+            }
+
+            void load() {
+                std::vector<char> page(head.page_size);
+                pm->recover_bytes(0, page.data(), page.size());
+                chain.push_back(0);
+
+                std::size_t n = std::min<std::size_t>(head.entries, first_capacity());
+                entries.resize(head.entries);
+                std::memcpy(entries.data(), page.data() + sizeof(header), n * sizeof(entry));
+
+                long next = head.next;
+                while (n < entries.size() && next != -1) {
+                    pm->recover_bytes(next, page.data(), page.size());
+                    chain.push_back(next);
+                    std::size_t m = std::min(entries.size() - n, chain_capacity());
+                    std::memcpy(entries.data() + n, page.data() + sizeof(long), m * sizeof(entry));
+                    n += m;
+                    std::memcpy(&next, page.data(), sizeof(long));
+                }
+            }
+
+            // Rewrites every catalog page, growing the chain when needed.
+            void flush() {
+                std::size_t needed = 1;
+                if (entries.size() > first_capacity()) {
+                    std::size_t rest = entries.size() - first_capacity();
+                    needed += (rest + chain_capacity() - 1) / chain_capacity();
+                }
+                while (chain.size() < needed) chain.push_back(allocate_page());
+                head.next = chain.size() > 1 ? chain[1] : -1;
+
+                std::vector<char> page(head.page_size, 0);
+                std::size_t n = std::min(entries.size(), first_capacity());
+                std::memcpy(page.data(), &head, sizeof(head));
+                std::memcpy(page.data() + sizeof(header), entries.data(), n * sizeof(entry));
+                pm->save_bytes(0, page.data(), page.size());
+
+                for (std::size_t c = 1; c < chain.size(); c++) {
+                    std::fill(page.begin(), page.end(), 0);
+                    long next = c + 1 < chain.size() ? chain[c + 1] : -1;
+                    std::size_t m = std::min(entries.size() - n, chain_capacity());
+                    std::memcpy(page.data(), &next, sizeof(long));
+                    std::memcpy(page.data() + sizeof(long), entries.data() + n, m * sizeof(entry));
+                    pm->save_bytes(chain[c], page.data(), page.size());
+                    n += m;
+                }
+            }
+        };
+
+    } // namespace disk
+
+} // namespace utec
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define UTEC_CRC32C_SSE42 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define UTEC_CRC32C_ARM 1
+#endif
+
+namespace utec {
+
+    namespace disk {
+
+        // CRC-32C (Castagnoli) of page images. Uses the SSE4.2 crc32
+        // instruction when the CPU has it, the ARMv8 one when the build
+        // targets it, and slicing-by-8 tables otherwise.
+        class crc32c {
+        public:
+            // Continues `crc` over [data, data + size).
+            static uint32_t extend(uint32_t crc, const void *data, std::size_t size) {
+                const unsigned char *p = static_cast<const unsigned char *>(data);
+#if UTEC_CRC32C_SSE42
+                if (hardware()) return ~sse42(~crc, p, size);
+#elif UTEC_CRC32C_ARM
+                return ~arm(~crc, p, size);
+#endif
+                return ~software(~crc, p, size);
+            }
+
+            static uint32_t of(const void *data, std::size_t size) { return extend(0, data, size); }
+
+            static bool hardware() {
+#if UTEC_CRC32C_SSE42
+                static const bool has = __builtin_cpu_supports("sse4.2");
+                return has;
+#elif UTEC_CRC32C_ARM
+                return true;
+#else
+                return false;
+#endif
+            }
+
+        private:
+            enum {
+                POLY = 0x82f63b78u,
+            };
+
+            struct tables {
+                uint32_t t[8][256];
+
+                tables() {
+                    for (uint32_t i = 0; i < 256; i++) {
+                        uint32_t c = i;
+                        for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ POLY : c >> 1;
+                        t[0][i] = c;
+                    }
+                    for (int s = 1; s < 8; s++) {
+                        for (int i = 0; i < 256; i++) t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xff];
+                    }
+                }
+            };
+
+            static uint32_t software(uint32_t c, const unsigned char *p, std::size_t n) {
+                static const tables tab;
+                const uint32_t (*t)[256] = tab.t;
+                for (; n >= 8; p += 8, n -= 8) {
+                    uint32_t lo, hi;
+                    std::memcpy(&lo, p, 4);
+                    std::memcpy(&hi, p + 4, 4);
+                    lo ^= c;
+                    c = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+                        t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+                }
+                while (n--) c = (c >> 8) ^ t[0][(c ^ *p++) & 0xff];
+                return c;
+            }
+
+#if UTEC_CRC32C_SSE42
+            __attribute__((target("sse4.2")))
+            static uint32_t sse42(uint32_t c, const unsigned char *p, std::size_t n) {
+                uint64_t c64 = c;
+                for (; n >= 8; p += 8, n -= 8) {
+                    uint64_t v;
+                    std::memcpy(&v, p, 8);
+                    c64 = _mm_crc32_u64(c64, v);
+                }
+                c = (uint32_t) c64;
+                while (n--) c = _mm_crc32_u8(c, *p++);
+                return c;
+            }
+#elif UTEC_CRC32C_ARM
+            static uint32_t arm(uint32_t c, const unsigned char *p, std::size_t n) {
+                for (; n >= 8; p += 8, n -= 8) {
+                    uint64_t v;
+                    std::memcpy(&v, p, 8);
+                    c = __crc32cd(c, v);
+                }
+                while (n--) c = __crc32cb(c, *p++);
+                return c;
+            }
+#endif
+        };
+
+    } // namespace disk
+
+} // namespace utec
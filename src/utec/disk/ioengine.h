@@ -0,0 +1,327 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define UTEC_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+namespace utec {
+
+    namespace disk {
+
+        // Asynchronous positional reads on a single file descriptor. Uses
+        // io_uring when the kernel allows it and falls back to a small pool
+        // of threads issuing pread otherwise.
+        class ioengine {
+        public:
+            typedef long ticket;
+
+            ioengine(int fd, unsigned depth = 64, unsigned threads = 4, bool use_uring = true) :
+                fd(fd), depth(depth), next_ticket(0), stop(false) {
+                if (!use_uring || !setup_uring()) {
+                    for (unsigned i = 0; i < threads; i++) {
+                        workers.push_back(std::thread(&ioengine::work, this));
+                    }
+                }
+            }
+
+            ~ioengine() {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    stop = true;
+                }
+                ready.notify_all();
+                for (auto &w : workers) w.join();
+#ifdef UTEC_HAVE_IO_URING
+                if (ring.fd >= 0) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    while (!inflight.empty()) reap_blocking(lock);
+                    lock.unlock();
+                    munmap(ring.sqes, ring.sqes_len);
+                    if (ring.cq_ptr != ring.sq_ptr) munmap(ring.cq_ptr, ring.cq_len);
+                    munmap(ring.sq_ptr, ring.sq_len);
+                    ::close(ring.fd);
+                }
+#endif
+            }
+
+            bool uses_io_uring() const {
+#ifdef UTEC_HAVE_IO_URING
+                return ring.fd >= 0;
+#else
+                return false;
+#endif
+            }
+
+            ticket submit(long offset, void *buf, std::size_t size) {
+                std::unique_lock<std::mutex> lock(mutex);
+                ticket t = next_ticket++;
+                request r{offset, static_cast<char *>(buf), size};
+#ifdef UTEC_HAVE_IO_URING
+                if (ring.fd >= 0) {
+                    while (inflight.size() >= depth) reap_blocking(lock);
+                    push_sqe(t, r);
+                    return t;
+                }
+#endif
+                queue.push_back(std::make_pair(t, r));
+                lock.unlock();
+                ready.notify_one();
+                return t;
+            }
+
+            // A ticket that is already complete, for reads served elsewhere.
+            ticket finish(long result) {
+                std::lock_guard<std::mutex> lock(mutex);
+                ticket t = next_ticket++;
+                done[t] = result;
+                return t;
+            }
+
+            // Blocks until the read behind `t` has completed and returns the
+            // number of bytes read (negative on error).
+            long wait(ticket t) {
+                std::unique_lock<std::mutex> lock(mutex);
+                for (;;) {
+                    auto it = done.find(t);
+                    if (it != done.end()) {
+                        long res = it->second;
+                        done.erase(it);
+                        return res;
+                    }
+#ifdef UTEC_HAVE_IO_URING
+                    if (ring.fd >= 0) {
+                        reap_blocking(lock);
+                        continue;
+                    }
+#endif
+                    finished.wait(lock);
+                }
+            }
+
+            // Hints the kernel to start reading a range it will soon be asked for.
+            void prefetch(long offset, std::size_t size) {
+#ifdef POSIX_FADV_WILLNEED
+                posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+#endif
+            }
+
+        private:
+            struct request {
+                long offset;
+                char *buf;
+                std::size_t size;
+            };
+
+            int fd;
+            unsigned depth;
+            ticket next_ticket;
+            bool stop;
+            bool reaping = false;   // a thread is blocked on the ring
+
+            std::mutex mutex;
+            std::condition_variable ready;
+            std::condition_variable finished;
+            std::deque<std::pair<ticket, request>> queue;
+            std::map<ticket, long> done;
+            std::vector<std::thread> workers;
+
+            static long read_fully(int fd, const request &r) {
+                std::size_t got = 0;
+                while (got < r.size) {
+                    ssize_t n = ::pread(fd, r.buf + got, r.size - got, r.offset + got);
+                    if (n < 0) return got ? (long) got : -1;
+                    if (n == 0) break;
+                    got += n;
+                }
+                return got;
+            }
+
+            void work() {
+                std::unique_lock<std::mutex> lock(mutex);
+                for (;;) {
+                    ready.wait(lock, [this] { return stop || !queue.empty(); });
+                    if (queue.empty()) return;
+                    std::pair<ticket, request> job = queue.front();
+                    queue.pop_front();
+                    lock.unlock();
+                    long res = read_fully(fd, job.second);
+                    lock.lock();
+                    done[job.first] = res;
+                    finished.notify_all();
+                }
+            }
+
+#ifdef UTEC_HAVE_IO_URING
+            struct uring {
+                int fd = -1;
+                void *sq_ptr = nullptr, *cq_ptr = nullptr;
+                std::size_t sq_len = 0, cq_len = 0, sqes_len = 0;
+                unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+                unsigned *cq_head, *cq_tail, *cq_mask;
+                io_uring_sqe *sqes;
+                io_uring_cqe *cqes;
+            } ring;
+
+            std::map<ticket, std::pair<request, iovec>> inflight;
+
+            bool setup_uring() {
+                io_uring_params p;
+                std::memset(&p, 0, sizeof(p));
+                int rfd = syscall(__NR_io_uring_setup, depth, &p);
+                if (rfd < 0) return false;
+
+                ring.sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+                ring.cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+                bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+                if (single) ring.sq_len = ring.cq_len = std::max(ring.sq_len, ring.cq_len);
+
+                ring.sq_ptr = mmap(0, ring.sq_len, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_SQ_RING);
+                if (ring.sq_ptr == MAP_FAILED) {
+                    ::close(rfd);
+                    return false;
+                }
+                ring.cq_ptr = single ? ring.sq_ptr :
+                              mmap(0, ring.cq_len, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_CQ_RING);
+                ring.sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+                void *sqes = ring.cq_ptr == MAP_FAILED ? MAP_FAILED :
+                             mmap(0, ring.sqes_len, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_SQES);
+                if (sqes == MAP_FAILED) {
+                    if (ring.cq_ptr != MAP_FAILED && !single) munmap(ring.cq_ptr, ring.cq_len);
+                    munmap(ring.sq_ptr, ring.sq_len);
+                    ::close(rfd);
+                    return false;
+                }
+
+                char *sq = static_cast<char *>(ring.sq_ptr);
+                char *cq = static_cast<char *>(ring.cq_ptr);
+                ring.sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+                ring.sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+                ring.sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+                ring.sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+                ring.cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+                ring.cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+                ring.cq_mask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+                ring.cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+                ring.sqes = static_cast<io_uring_sqe *>(sqes);
+                ring.fd = rfd;
+                if (depth > p.sq_entries) depth = p.sq_entries;
+                return true;
+            }
+
+            void push_sqe(ticket t, const request &r) {
+                std::pair<request, iovec> &slot = inflight[t];
+                slot.first = r;
+                slot.second.iov_base = r.buf;
+                slot.second.iov_len = r.size;
+
+                unsigned tail = *ring.sq_tail;
+                unsigned idx = tail & *ring.sq_mask;
+                io_uring_sqe *sqe = &ring.sqes[idx];
+                std::memset(sqe, 0, sizeof(*sqe));
+                sqe->opcode = IORING_OP_READV;
+                sqe->fd = fd;
+                sqe->off = r.offset;
+                sqe->addr = reinterpret_cast<unsigned long>(&slot.second);
+                sqe->len = 1;
+                sqe->user_data = t;
+                ring.sq_array[idx] = idx;
+                __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+                long ret;
+                do {
+                    ret = syscall(__NR_io_uring_enter, ring.fd, 1, 0, 0, nullptr, 0);
+                } while (ret < 0 && errno == EINTR);
+                if (ret == 1 || __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) != tail) return;
+                // The kernel did not take the entry (EAGAIN, EBUSY, ...):
+                // withdraw it and read synchronously instead.
+                __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+                inflight.erase(t);
+                done[t] = read_fully(fd, r);
+            }
+
+            // Waits for a completion. One thread at a time blocks in the
+            // kernel, with `mutex` released so others can keep submitting;
+            // the rest sleep on `finished` until it has reaped.
+            void reap_blocking(std::unique_lock<std::mutex> &lock) {
+                if (reaping) {
+                    finished.wait(lock);
+                    return;
+                }
+                if (reap()) {
+                    finished.notify_all();
+                    return;
+                }
+                reaping = true;
+                lock.unlock();
+                long ret = 0;
+                if (*ring.cq_head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+                    ret = syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                }
+                int err = errno;
+                lock.lock();
+                reaping = false;
+                if (!reap() && ret < 0 && err != EINTR) {
+                    // The ring is unusable; fail what it still holds.
+                    for (auto &f : inflight) done[f.first] = -err;
+                    inflight.clear();
+                }
+                finished.notify_all();
+            }
+
+            // Moves every available completion into `done`; returns how
+            // many there were. Called with `mutex` held.
+            int reap() {
+                unsigned head = *ring.cq_head;
+                int reaped = 0;
+                while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+                    io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+                    ticket t = cqe->user_data;
+                    long res = cqe->res;
+                    head++;
+                    auto it = inflight.find(t);
+                    if (it != inflight.end()) {
+                        request r = it->second.first;
+                        inflight.erase(it);
+                        // Short reads are finished synchronously.
+                        if (res >= 0 && (std::size_t) res < r.size) {
+                            request rest{r.offset + res, r.buf + res, r.size - res};
+                            long more = read_fully(fd, rest);
+                            if (more > 0) res += more;
+                        }
+                    }
+                    done[t] = res;
+                    reaped++;
+                }
+                __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+                return reaped;
+            }
+#else
+            bool setup_uring() { return false; }
+#endif
+        };
+
+    } // namespace disk
+
+} // namespace utec
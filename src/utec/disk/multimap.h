@@ -0,0 +1,368 @@
+#pragma once
+
+#include "bstar.h"
+#include "catalog.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace utec {
+
+    namespace disk {
+
+        // One distinct key with its row ids. Up to INLINE ids live in the tree
+        // entry itself; longer lists move to a chain of overflow pages.
+        template <class K, int INLINE>
+        struct posting {
+            K key;
+            long count;
+            long overflow;
+            long ids[INLINE];
+        };
+
+        template <class K, int INLINE>
+        bool operator<(const posting<K, INLINE> &a, const posting<K, INLINE> &b) { return a.key < b.key; }
+
+        template <class K, int INLINE>
+        bool operator<=(const posting<K, INLINE> &a, const posting<K, INLINE> &b) { return !(b.key < a.key); }
+
+        template <class K, int INLINE>
+        bool operator==(const posting<K, INLINE> &a, const posting<K, INLINE> &b) { return a.key == b.key; }
+
+        template <class K, int INLINE>
+        bool operator!=(const posting<K, INLINE> &a, const posting<K, INLINE> &b) { return !(a.key == b.key); }
+
+        // Postings compare by key only, so only the key is hashed.
+        template <class K, int INLINE>
+        struct bloomhash<posting<K, INLINE>> {
+            uint64_t operator()(const posting<K, INLINE> &p) const { return bloomhash<K>()(p.key); }
+        };
+
+        template <class K, int INLINE>
+        struct bloomequal<posting<K, INLINE>> {
+            bool operator()(const posting<K, INLINE> &a, const posting<K, INLINE> &b) const {
+                return bloomequal<K>()(a.key, b.key);
+            }
+        };
+
+        // Secondary index mapping each key to a sorted set of row ids. Overflow
+        // pages hold a sorted run each, stored as varint deltas.
+        template <class K, int BSTAR_ORDER = 31, int INLINE = 4>
+        class multimap {
+        public:
+            typedef posting<K, INLINE> entry;
+
+            multimap(std::shared_ptr<catalog> cat, const std::string &name) :
+                cat{cat}, pm{cat->pager()}, tree{cat, name} {}
+
+            // Adds `row` under `key`; false if it was already there.
+            bool insert(const K &key, long row) {
+                entry e;
+                if (!find(key, e)) {
+                    e.key = key;
+                    e.count = 1;
+                    e.overflow = -1;
+                    e.ids[0] = row;
+                    tree.insert(e);
+                    return true;
+                }
+                if (e.overflow == -1) {
+                    long *end = e.ids + e.count;
+                    long *at = std::lower_bound(e.ids, end, row);
+                    if (at != end && *at == row) return false;
+                    if (e.count < INLINE) {
+                        std::copy_backward(at, end, end + 1);
+                        *at = row;
+                        e.count++;
+                        tree.update(e);
+                        return true;
+                    }
+                    std::vector<long> ids(e.ids, end);
+                    ids.insert(ids.begin() + (at - e.ids), row);
+                    e.overflow = write_runs(ids);
+                    e.count++;
+                    tree.update(e);
+                    return true;
+                }
+                if (!insert_run(e.overflow, row)) return false;
+                e.count++;
+                tree.update(e);
+                return true;
+            }
+
+            // Removes `row` from `key`; false if it was not there.
+            bool remove(const K &key, long row) {
+                entry e;
+                if (!find(key, e)) return false;
+                if (e.overflow == -1) {
+                    long *end = e.ids + e.count;
+                    long *at = std::lower_bound(e.ids, end, row);
+                    if (at == end || *at != row) return false;
+                    std::copy(at + 1, end, at);
+                    e.count--;
+                } else {
+                    if (!remove_run(e.overflow, row)) return false;
+                    e.count--;
+                    if (e.count <= INLINE / 2) {
+                        std::vector<long> ids = read_runs(e.overflow);
+                        free_runs(e.overflow);
+                        std::copy(ids.begin(), ids.end(), e.ids);
+                        e.overflow = -1;
+                    }
+                }
+                if (e.count == 0) tree.remove(e);
+                else tree.update(e);
+                return true;
+            }
+
+            // Drops `key` and all of its rows.
+            bool remove(const K &key) {
+                entry e;
+                if (!find(key, e)) return false;
+                if (e.overflow != -1) free_runs(e.overflow);
+                tree.remove(e);
+                return true;
+            }
+
+            long count(const K &key) {
+                entry e;
+                return find(key, e) ? e.count : 0;
+            }
+
+            // Calls f(row) for every row of `key` in ascending order, decoding
+            // one overflow page at a time.
+            template <class F>
+            void for_each(const K &key, F f) {
+                entry e;
+                if (!find(key, e)) return;
+                if (e.overflow == -1) {
+                    for (long i = 0; i < e.count; i++) f(e.ids[i]);
+                    return;
+                }
+                std::vector<char> page(pm->page_size());
+                std::vector<long> ids;
+                for (long id = e.overflow; id != -1; ) {
+                    run &r = read_run(id, page);
+                    decode(r, ids);
+                    for (long row : ids) f(row);
+                    id = r.next;
+                }
+            }
+
+            std::vector<long> rows(const K &key) {
+                std::vector<long> out;
+                for_each(key, [&out](long row) { out.push_back(row); });
+                return out;
+            }
+
+            bstar<entry, BSTAR_ORDER> &index() { return tree; }
+
+        private:
+            struct run {
+                long next;
+                long count;
+                long first;
+                long last;
+                long bytes;
+                unsigned char data[1];
+            };
+
+            enum {
+                RUN_HEADER = offsetof(run, data),
+            };
+
+            std::shared_ptr<catalog> cat;
+            std::shared_ptr<pagemanager> pm;
+            bstar<entry, BSTAR_ORDER> tree;
+
+            bool find(const K &key, entry &e) {
+                entry probe{};
+                probe.key = key;
+                return tree.lookup(probe, e);
+            }
+
+            long capacity() {
+                return pm->page_size() - RUN_HEADER;
+            }
+
+            run &read_run(long id, std::vector<char> &page) {
+                pm->recover_bytes(id, page.data(), page.size());
+                return *reinterpret_cast<run *>(page.data());
+            }
+
+            static void put_varint(std::vector<unsigned char> &out, uint64_t v) {
+                while (v >= 0x80) {
+                    out.push_back((v & 0x7f) | 0x80);
+                    v >>= 7;
+                }
+                out.push_back(v);
+            }
+
+            static void decode(const run &r, std::vector<long> &ids) {
+                ids.clear();
+                long prev = r.first;
+                const unsigned char *p = r.data;
+                for (long i = 0; i < r.count; i++) {
+                    uint64_t delta = 0;
+                    int shift = 0;
+                    while (*p & 0x80) {
+                        delta |= uint64_t(*p++ & 0x7f) << shift;
+                        shift += 7;
+                    }
+                    delta |= uint64_t(*p++) << shift;
+                    prev += delta;
+                    ids.push_back(prev);
+                }
+            }
+
+            static std::vector<unsigned char> encode(const long *begin, const long *end) {
+                std::vector<unsigned char> out;
+                long prev = *begin;
+                for (const long *it = begin; it != end; ++it) {
+                    put_varint(out, *it - prev);
+                    prev = *it;
+                }
+                return out;
+            }
+
+            // Longest prefix of [begin, end) whose encoding fits in one page.
+            long fitting(const long *begin, const long *end) {
+                long n = 0, size = 0, cap = capacity();
+                long prev = *begin;
+                for (const long *it = begin; it != end; ++it, n++) {
+                    uint64_t delta = *it - prev;
+                    int len = 1;
+                    while (delta >= 0x80) {
+                        delta >>= 7;
+                        len++;
+                    }
+                    if (size + len > cap) break;
+                    size += len;
+                    prev = *it;
+                }
+                return n;
+            }
+
+            void write_run(long id, long next, const long *begin, const long *end) {
+                std::vector<char> page(pm->page_size(), 0);
+                run &r = *reinterpret_cast<run *>(page.data());
+                std::vector<unsigned char> bytes = encode(begin, end);
+                r.next = next;
+                r.count = end - begin;
+                r.first = *begin;
+                r.last = *(end - 1);
+                r.bytes = bytes.size();
+                std::memcpy(r.data, bytes.data(), bytes.size());
+                pm->save_bytes(id, page.data(), RUN_HEADER + bytes.size());
+            }
+
+            // Writes sorted ids as a fresh chain, filling pages to capacity.
+            long write_runs(const std::vector<long> &ids) {
+                std::vector<std::pair<long, long>> spans;
+                const long *p = ids.data(), *end = ids.data() + ids.size();
+                while (p != end) {
+                    long n = fitting(p, end);
+                    spans.push_back(std::make_pair(p - ids.data(), n));
+                    p += n;
+                }
+                std::vector<long> pages;
+                for (std::size_t i = 0; i < spans.size(); i++) pages.push_back(cat->allocate());
+                for (std::size_t i = 0; i < spans.size(); i++) {
+                    const long *b = ids.data() + spans[i].first;
+                    write_run(pages[i], i + 1 < pages.size() ? pages[i + 1] : -1, b, b + spans[i].second);
+                }
+                return pages[0];
+            }
+
+            std::vector<long> read_runs(long head) {
+                std::vector<long> out, ids;
+                std::vector<char> page(pm->page_size());
+                for (long id = head; id != -1; ) {
+                    run &r = read_run(id, page);
+                    decode(r, ids);
+                    out.insert(out.end(), ids.begin(), ids.end());
+                    id = r.next;
+                }
+                return out;
+            }
+
+            void free_runs(long head) {
+                std::vector<char> page(pm->page_size());
+                for (long id = head; id != -1; ) {
+                    long next = read_run(id, page).next;
+                    cat->release(id);
+                    id = next;
+                }
+            }
+
+            // Rewrites run `id` with `ids`, splitting it into as many pages as
+            // needed; the extra pages are linked in before `next`.
+            void rewrite_run(long id, long next, const std::vector<long> &ids) {
+                const long *p = ids.data(), *end = ids.data() + ids.size();
+                long current = id;
+                while (p != end) {
+                    long n = fitting(p, end);
+                    long after = p + n == end ? next : cat->allocate();
+                    write_run(current, after, p, p + n);
+                    current = after;
+                    p += n;
+                }
+            }
+
+            bool insert_run(long head, long row) {
+                std::vector<char> page(pm->page_size());
+                std::vector<long> ids;
+                for (long id = head; ; ) {
+                    run &r = read_run(id, page);
+                    if (row <= r.last || r.next == -1) {
+                        decode(r, ids);
+                        auto at = std::lower_bound(ids.begin(), ids.end(), row);
+                        if (at != ids.end() && *at == row) return false;
+                        ids.insert(at, row);
+                        rewrite_run(id, r.next, ids);
+                        return true;
+                    }
+                    id = r.next;
+                }
+            }
+
+            bool remove_run(long &head, long row) {
+                std::vector<char> page(pm->page_size());
+                std::vector<long> ids;
+                long prev = -1;
+                for (long id = head; id != -1; ) {
+                    run &r = read_run(id, page);
+                    if (row < r.first) return false;
+                    if (row <= r.last) {
+                        decode(r, ids);
+                        auto at = std::lower_bound(ids.begin(), ids.end(), row);
+                        if (at == ids.end() || *at != row) return false;
+                        ids.erase(at);
+                        long next = r.next;
+                        if (!ids.empty()) {
+                            write_run(id, next, ids.data(), ids.data() + ids.size());
+                        } else if (prev == -1) {
+                            head = next;
+                            cat->release(id);
+                        } else {
+                            run &p = read_run(prev, page);
+                            p.next = next;
+                            pm->save_bytes(prev, page.data(), RUN_HEADER + p.bytes);
+                            cat->release(id);
+                        }
+                        return true;
+                    }
+                    prev = id;
+                    id = r.next;
+                }
+                return false;
+            }
+        };
+
+    } // namespace disk
+
+} // namespace utec
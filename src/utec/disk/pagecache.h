@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace utec {
+
+    namespace disk {
+
+        // Fixed-capacity LRU cache of whole pages, keyed by page id. Shared by
+        // every tree that goes through the same pagemanager.
+        class pagecache {
+        public:
+            pagecache(long page_size, long capacity) :
+                page_size(page_size), capacity(capacity) {}
+
+            bool get(long id, void *buf, std::size_t size) {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = index.find(id);
+                if (it == index.end()) return false;
+                pages.splice(pages.begin(), pages, it->second);
+                std::memcpy(buf, it->second->second.data(), size);
+                return true;
+            }
+
+            // Inserts a whole page.
+            void put(long id, const void *page) {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = index.find(id);
+                if (it != index.end()) {
+                    pages.splice(pages.begin(), pages, it->second);
+                } else {
+                    if ((long) index.size() >= capacity) {
+                        index.erase(pages.back().first);
+                        pages.pop_back();
+                    }
+                    pages.push_front(std::make_pair(id, std::vector<char>(page_size)));
+                    index[id] = pages.begin();
+                }
+                std::memcpy(pages.front().second.data(), page, page_size);
+            }
+
+            // Overwrites the first `size` bytes of a page if it is cached.
+            void update(long id, const void *buf, std::size_t size) {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = index.find(id);
+                if (it == index.end()) return;
+                std::memcpy(it->second->second.data(), buf, size);
+            }
+
+            void erase(long id) {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = index.find(id);
+                if (it == index.end()) return;
+                pages.erase(it->second);
+                index.erase(it);
+            }
+
+            void clear() {
+                std::lock_guard<std::mutex> lock(mutex);
+                pages.clear();
+                index.clear();
+            }
+
+        private:
+            typedef std::list<std::pair<long, std::vector<char>>> lru;
+
+            long page_size;
+            long capacity;
+            std::mutex mutex;
+            lru pages;
+            std::unordered_map<long, lru::iterator> index;
+        };
+
+    } // namespace disk
+
+} // namespace utec
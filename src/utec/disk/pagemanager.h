@@ -1,62 +1,398 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
 #include <cstdlib>
+#include <cstring>
+#include <exception>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "ioengine.h"
+#include "pagecache.h"
+#include "stats.h"
 
 namespace utec {
 
     namespace disk {
 
-        class pagemanager : protected std::fstream {
+        class pagemanager {
 
         public:
-            pagemanager(std::string file_name, bool trunc = false):
-            std::fstream(file_name.data(), std::ios::in | std::ios::out | std::ios::binary){
-                empty = false;
+            typedef ioengine::ticket ticket;
+
+            // Holds back the writes made while it lives and flushes them
+            // when the outermost batch ends; batches nest. A failed flush
+            // throws from the destructor unless an exception is already
+            // on its way out, which then wins.
+            class batch {
+            public:
+                explicit batch(pagemanager &pm) : pm(pm) { pm.begin_batch(); }
+
+                ~batch() noexcept(false) {
+                    if (!unwinding()) {
+                        pm.end_batch();
+                        return;
+                    }
+                    try {
+                        pm.end_batch();
+                    } catch (...) {
+                    }
+                }
+
+                batch(const batch &) = delete;
+                batch &operator=(const batch &) = delete;
+
+            private:
+                pagemanager &pm;
+
+                static bool unwinding() {
+#if defined(__cpp_lib_uncaught_exceptions)
+                    return std::uncaught_exceptions() > 0;
+#else
+                    return std::uncaught_exception();
+#endif
+                }
+            };
+
+            // With a `page_size` every page n lives at n * page_size, whatever
+            // is stored in it, so differently sized nodes (and several trees)
+            // can share the file; `cache_pages` then enables a shared LRU
+            // cache of that many pages. Without a page size a Register is
+            // addressed in units of its own size.
+            pagemanager(std::string file_name, bool trunc = false, long page_size = 0, long cache_pages = 0) {
+                empty = trunc;
                 fileName = file_name;
-                if (!good() || trunc) {
+                pageSize = page_size;
+                fd = ::open(file_name.data(), O_RDWR | O_CREAT | (trunc ? O_TRUNC : 0), 0644);
+                struct stat st;
+                if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
                     empty = true;
-                    open(file_name.data(), std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
                 }
+                if (page_size && cache_pages) cache.reset(new pagecache(page_size, cache_pages));
             }
 
             ~pagemanager(){
+                engine.reset();
                 close();
             }
 
             inline bool is_empty() { return empty; }
 
+            inline long page_size() { return pageSize; }
+
+            const std::string &file_name() { return fileName; }
+
             template <class Register> void save(const long &n, Register &reg) {
-                clear();
-                seekp(n * sizeof(Register), std::ios::beg);
-                write(reinterpret_cast<const char *>(&reg), sizeof(reg));
+                write_at(n, offset<Register>(n), &reg, sizeof(reg));
             }
 
             template <class Register> bool recover(const long &n, Register &reg) {
-                clear();
-                seekg(n * sizeof(Register), std::ios::beg);
-                read(reinterpret_cast<char *>(&reg), sizeof(reg));
-                return gcount() > 0;
+                return read_at(n, offset<Register>(n), &reg, sizeof(reg));
+            }
+
+            // Raw access to the first `size` bytes of a fixed-size page.
+            void save_bytes(const long &n, const void *buf, std::size_t size) {
+                write_at(n, n * pageSize, buf, size);
+            }
+
+            bool recover_bytes(const long &n, void *buf, std::size_t size) {
+                return read_at(n, n * pageSize, buf, size);
             }
 
             template <class Register> void erase(const long &n) {
-                char mark;
-                clear();
-                mark = 'N';
-                seekg(n * sizeof(Register), std::ios::beg);
-                write(&mark, 1);
+                char mark = 'N';
+                if (cache) cache->erase(n);
+                std::lock_guard<std::mutex> lock(dirty_mutex);
+                if (depth || staged) {
+                    stage(offset<Register>(n), &mark, 1);
+                    if (!depth) flush();
+                    return;
+                }
+                iovec v{&mark, 1};
+                write_run(offset<Register>(n), &v, 1);
             }
 
+            // Between begin_batch() and the matching end_batch() writes are
+            // kept as dirty pages, which reads see. The outermost end
+            // writes them in file order, each run of adjacent pages with
+            // one pwritev. A batch over BATCH_BYTES is flushed early. A
+            // failed write throws runtime_error and leaves the pages dirty,
+            // so reads still see them and the next flush retries them.
+            void begin_batch() {
+                std::lock_guard<std::mutex> lock(dirty_mutex);
+                depth++;
+            }
+
+            void end_batch() {
+                std::lock_guard<std::mutex> lock(dirty_mutex);
+                if (--depth == 0) flush();
+            }
+
+            // Starts reading page `n` into `reg`, which must stay alive until
+            // wait() returns for the ticket.
+            template <class Register> ticket recover_async(const long &n, Register &reg) {
+                if (staged && is_dirty(offset<Register>(n), sizeof(reg))) {
+                    read_at(n, offset<Register>(n), &reg, sizeof(reg));
+                    return io().finish(sizeof(reg));
+                }
+                if (cache && cache->get(n, &reg, sizeof(reg))) {
+                    counters.add(statistics::CACHE_HITS);
+                    return io().finish(sizeof(reg));
+                }
+                counters.add(statistics::PAGES_READ);
+                counters.add(statistics::BYTES_READ, sizeof(reg));
+                ticket t = io().submit(offset<Register>(n), &reg, sizeof(reg));
+                if (cache) {
+                    std::lock_guard<std::mutex> lock(loading_mutex);
+                    loading[t] = loading_page{n, &reg, sizeof(reg)};
+                }
+                return t;
+            }
+
+            bool wait(ticket t) {
+                long res = io().wait(t);
+                if (cache) {
+                    std::lock_guard<std::mutex> lock(loading_mutex);
+                    auto it = loading.find(t);
+                    if (it != loading.end()) {
+                        if (res == pageSize) cache->put(it->second.id, it->second.buf);
+                        loading.erase(it);
+                    }
+                }
+                return res > 0;
+            }
+
+            template <class Register> void prefetch(const long &n) {
+                io().prefetch(offset<Register>(n), sizeof(Register));
+            }
+
+            ioengine &io() {
+                std::call_once(engine_once, [this] { engine.reset(new ioengine(fd)); });
+                return *engine;
+            }
+
+            statistics &stats() { return counters; }
+
         private:
+            struct loading_page {
+                long id;
+                void *buf;
+                std::size_t size;
+            };
+
+            enum {
+                BATCH_BYTES = 1 << 20,
+#ifdef IOV_MAX
+                MAX_IOV = IOV_MAX,
+#else
+                MAX_IOV = 1024,
+#endif
+            };
+
             std::string fileName;
-            int pageSize;
+            long pageSize;
             bool empty;
             long page_id_count;
+            int fd;
+            std::once_flag engine_once;
+            std::unique_ptr<ioengine> engine;
+            std::unique_ptr<pagecache> cache;
+            std::mutex loading_mutex;
+            std::map<ticket, loading_page> loading;
+            statistics counters;
+            std::mutex dirty_mutex;
+            std::map<long, std::vector<char>> dirty;   // by file offset
+            std::size_t dirty_bytes = 0;
+            int depth = 0;
+            std::atomic<bool> staged{false};
+
+            void write_at(long n, long pos, const void *data, std::size_t size) {
+                if (cache) {
+                    if ((long) size == pageSize) cache->put(n, data);
+                    else cache->update(n, data, size);
+                    std::lock_guard<std::mutex> lock(loading_mutex);
+                    for (auto it = loading.begin(); it != loading.end(); ) {
+                        if (it->second.id == n) it = loading.erase(it);
+                        else ++it;
+                    }
+                }
+                counters.add(statistics::PAGES_WRITTEN);
+                counters.add(statistics::BYTES_WRITTEN, size);
+                std::lock_guard<std::mutex> lock(dirty_mutex);
+                // Pages left dirty by a failed flush go out with this write,
+                // so a stale staged copy never outlives a newer one.
+                if (depth || staged) {
+                    stage(pos, data, size);
+                    if (!depth) flush();
+                    return;
+                }
+                iovec v{const_cast<void *>(data), size};
+                write_run(pos, &v, 1);
+            }
+
+            // Adds a write to the dirty set, over an earlier one to the same
+            // page. One that partly overlaps another page (Registers of mixed
+            // sizes without a page size) flushes the set first to keep the
+            // order of the two.
+            void stage(long pos, const void *data, std::size_t size) {
+                auto it = dirty.find(pos);
+                bool fits = it != dirty.end() && size <= it->second.size();
+                if (!fits && overlaps(pos, size)) {
+                    flush();
+                    it = dirty.end();
+                }
+                if (it == dirty.end()) it = dirty.insert(std::make_pair(pos, std::vector<char>())).first;
+                std::vector<char> &bytes = it->second;
+                if (bytes.size() < size) {
+                    dirty_bytes += size - bytes.size();
+                    bytes.resize(size);
+                }
+                std::memcpy(bytes.data(), data, size);
+                staged = true;
+                if (dirty_bytes > BATCH_BYTES) flush();
+            }
+
+            // Whether [pos, pos + size) meets a dirty page starting elsewhere.
+            bool overlaps(long pos, std::size_t size) {
+                auto it = dirty.lower_bound(pos);
+                if (it != dirty.end() && it->first == pos) ++it;
+                if (it != dirty.end() && it->first < pos + (long) size) return true;
+                it = dirty.lower_bound(pos);
+                if (it == dirty.begin()) return false;
+                --it;
+                return it->first + (long) it->second.size() > pos;
+            }
+
+            // Serves a read from the dirty page at `pos` when it holds it all.
+            bool read_dirty(long pos, void *data, std::size_t size) {
+                std::lock_guard<std::mutex> lock(dirty_mutex);
+                auto it = dirty.find(pos);
+                if (it == dirty.end() || it->second.size() < size) return false;
+                std::memcpy(data, it->second.data(), size);
+                return true;
+            }
+
+            bool is_dirty(long pos, std::size_t size) {
+                std::lock_guard<std::mutex> lock(dirty_mutex);
+                return dirty.count(pos) || overlaps(pos, size);
+            }
+
+            // Copies the dirty bytes inside [pos, pos + size) over `buf`.
+            void overlay(long pos, char *buf, std::size_t size) {
+                std::lock_guard<std::mutex> lock(dirty_mutex);
+                auto it = dirty.upper_bound(pos);
+                if (it != dirty.begin()) --it;
+                for (; it != dirty.end() && it->first < pos + (long) size; ++it) {
+                    long from = std::max(pos, it->first);
+                    long to = std::min(pos + (long) size, it->first + (long) it->second.size());
+                    if (from < to) std::memcpy(buf + (from - pos), it->second.data() + (from - it->first), to - from);
+                }
+            }
+
+            void flush() {
+                std::vector<iovec> run;
+                long start = 0, end = 0;
+                for (auto &d : dirty) {
+                    if (!run.empty() && (d.first != end || run.size() == MAX_IOV)) {
+                        write_run(start, run.data(), run.size());
+                        run.clear();
+                    }
+                    if (run.empty()) start = end = d.first;
+                    run.push_back(iovec{d.second.data(), d.second.size()});
+                    end += d.second.size();
+                }
+                if (!run.empty()) write_run(start, run.data(), run.size());
+                // Only once every run is on disk.
+                dirty.clear();
+                dirty_bytes = 0;
+                staged = false;
+            }
+
+            // Writes the buffers of `v` back to back from `pos`, resuming
+            // after short and interrupted writes.
+            void write_run(long pos, iovec *v, int count) {
+                while (count) {
+                    counters.add(statistics::WRITE_CALLS);
+                    ssize_t w = count == 1 ? ::pwrite(fd, v->iov_base, v->iov_len, pos) : ::pwritev(fd, v, count, pos);
+                    if (w < 0 && errno == EINTR) continue;
+                    if (w <= 0) {
+                        std::string why = w < 0 ? std::strerror(errno) : "nothing written";
+                        throw std::runtime_error("cannot write " + fileName + " at " + std::to_string(pos) + ": " + why);
+                    }
+                    pos += w;
+                    while (count && (std::size_t) w >= v->iov_len) {
+                        w -= v->iov_len;
+                        v++;
+                        count--;
+                    }
+                    if (count) {
+                        v->iov_base = static_cast<char *>(v->iov_base) + w;
+                        v->iov_len -= w;
+                    }
+                }
+            }
+
+            bool read_at(long n, long pos, void *data, std::size_t size) {
+                if (cache && cache->get(n, data, size)) {
+                    counters.add(statistics::CACHE_HITS);
+                    return true;
+                }
+                if (staged && read_dirty(pos, data, size)) return true;
+                // A miss pulls the whole page into the cache.
+                std::vector<char> page;
+                std::size_t want = size;
+                char *buf = static_cast<char *>(data);
+                if (cache) {
+                    page.resize(pageSize);
+                    buf = page.data();
+                    want = pageSize;
+                }
+                counters.add(statistics::PAGES_READ);
+                counters.add(statistics::BYTES_READ, want);
+                std::size_t done = 0;
+                while (done < want) {
+                    ssize_t r = ::pread(fd, buf + done, want - done, pos + done);
+                    if (r <= 0) break;
+                    done += r;
+                }
+                if (staged && is_dirty(pos, want)) {
+                    std::fill(buf + done, buf + want, 0);
+                    overlay(pos, buf, want);
+                    done = want;
+                }
+                if (cache) {
+                    std::fill(page.begin() + done, page.end(), 0);
+                    cache->put(n, page.data());
+                    std::memcpy(data, page.data(), size);
+                }
+                return done > 0;
+            }
+
+            template <class Register> long offset(long n) {
+                return n * (pageSize ? pageSize : (long) sizeof(Register));
+            }
+
+            void close() {
+                if (fd >= 0) ::close(fd);
+                fd = -1;
+            }
 
         };
 
     } // namespace disk
 
-} // namespace utec
\ No newline at end of file
+} // namespace utec
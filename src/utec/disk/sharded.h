@@ -0,0 +1,274 @@
+#pragma once
+
+#include "bstar.h"
+#include "pagemanager.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace utec {
+
+    namespace disk {
+
+        // Splits the key space into ranges, each held by its own bstar in
+        // its own file, so writers to different ranges never share a root.
+        // Shard i holds the keys in [bounds[i-1], bounds[i]). The layout is
+        // kept in `<prefix>.shards`, the trees in `<prefix>.<id>.index`.
+        //
+        // insert/remove/find may run concurrently; split() and iteration
+        // must not overlap with writers.
+        template <class T, int BSTAR_ORDER = 3>
+        class sharded_bstar {
+        public:
+            typedef bstar<T, BSTAR_ORDER> tree_type;
+
+            class iterator {
+            public:
+                T operator*() { return *it; }
+
+                iterator &operator++() {
+                    ++it;
+                    skip();
+                    return *this;
+                }
+
+                bool operator==(const iterator &other) {
+                    if (shard != other.shard) return false;
+                    return shard == owner->shards.size() || it == other.it;
+                }
+
+                bool operator!=(const iterator &other) { return !(*this == other); }
+
+            private:
+                friend class sharded_bstar;
+
+                sharded_bstar *owner;
+                std::size_t shard;
+                typename tree_type::iterator it;
+
+                iterator(sharded_bstar *owner, std::size_t shard, typename tree_type::iterator it) :
+                    owner(owner), shard(shard), it(it) {}
+
+                // Steps over exhausted shards.
+                void skip() {
+                    while (shard < owner->shards.size() && it == owner->shards[shard]->tree->end()) {
+                        if (++shard < owner->shards.size()) it = owner->shards[shard]->tree->begin();
+                    }
+                }
+            };
+
+            // Opens the shards stored under `prefix`, or creates one shard per
+            // range delimited by the sorted `bounds` when there are none yet.
+            sharded_bstar(const std::string &prefix, const std::vector<T> &bounds = std::vector<T>()) :
+                prefix(prefix) {
+                if (!load_layout()) {
+                    if (!std::is_sorted(bounds.begin(), bounds.end())) {
+                        throw std::invalid_argument("shard bounds must be sorted");
+                    }
+                    this->bounds = bounds;
+                    for (std::size_t i = 0; i <= bounds.size(); i++) shards.emplace_back(open_shard(next_id++, true));
+                    save_layout();
+                }
+            }
+
+            std::size_t shard_of(const T &key) const {
+                return std::upper_bound(bounds.begin(), bounds.end(), key) - bounds.begin();
+            }
+
+            void insert(const T &key) {
+                shard &s = *shards[shard_of(key)];
+                std::lock_guard<std::mutex> lock(s.mutex);
+                s.tree->insert(key);
+                s.writes++;
+            }
+
+            bool remove(const T &key) {
+                shard &s = *shards[shard_of(key)];
+                std::lock_guard<std::mutex> lock(s.mutex);
+                s.writes++;
+                return s.tree->remove(key);
+            }
+
+            bool contains(const T &key) {
+                shard &s = *shards[shard_of(key)];
+                std::lock_guard<std::mutex> lock(s.mutex);
+                return s.tree->find(key) != s.tree->end();
+            }
+
+            // Routes `keys` to their shards and inserts each shard's part on
+            // its own worker, at most `threads` at a time.
+            void insert_batch(const std::vector<T> &keys, unsigned threads = std::thread::hardware_concurrency()) {
+                std::vector<std::vector<T>> parts(shards.size());
+                for (const T &key : keys) parts[shard_of(key)].push_back(key);
+
+                std::atomic<std::size_t> next(0);
+                auto worker = [&]() {
+                    for (std::size_t i = next++; i < parts.size(); i = next++) {
+                        if (parts[i].empty()) continue;
+                        shard &s = *shards[i];
+                        std::lock_guard<std::mutex> lock(s.mutex);
+                        for (const T &key : parts[i]) s.tree->insert(key);
+                        s.writes += parts[i].size();
+                    }
+                };
+                std::vector<std::thread> pool;
+                for (unsigned t = 1; t < std::max(1u, threads) && t < parts.size(); t++) pool.emplace_back(worker);
+                worker();
+                for (auto &t : pool) t.join();
+            }
+
+            // Writes per shard since it was opened or last split; the largest
+            // is the first candidate for split().
+            std::vector<long> load() const {
+                std::vector<long> out;
+                for (auto &s : shards) out.push_back(s->writes);
+                return out;
+            }
+
+            std::size_t hottest() const {
+                std::vector<long> w = load();
+                return std::max_element(w.begin(), w.end()) - w.begin();
+            }
+
+            // Moves the upper half of shard `i` into a new shard placed right
+            // after it. Returns false if the shard has fewer than two
+            // distinct keys. The keys are copied and the layout saved before
+            // they leave shard `i`; copies a crash leaves behind above the
+            // new bound are dropped when the index is next opened.
+            bool split(std::size_t i) {
+                shard &s = *shards[i];
+                std::vector<T> keys;
+                for (auto it = s.tree->begin(); it != s.tree->end(); ++it) keys.push_back(*it);
+                if (keys.empty() || !(keys.front() < keys.back())) return false;
+
+                auto middle = keys.begin() + keys.size() / 2;
+                auto first = std::lower_bound(keys.begin(), keys.end(), *middle);
+                if (first == keys.begin()) first = std::upper_bound(keys.begin(), keys.end(), *middle);
+
+                long id = next_id++;
+                std::unique_ptr<shard> upper(open_shard(id, true));
+                for (auto it = first; it != keys.end(); ++it) upper->tree->insert(*it);
+                bounds.insert(bounds.begin() + i, *first);
+                shards.insert(shards.begin() + i + 1, std::move(upper));
+                try {
+                    save_layout();
+                } catch (...) {
+                    bounds.erase(bounds.begin() + i);
+                    shards.erase(shards.begin() + i + 1);
+                    std::remove(file_of(id).c_str());
+                    throw;
+                }
+                for (auto it = first; it != keys.end(); ++it) s.tree->remove(*it);
+                s.writes = 0;
+                return true;
+            }
+
+            std::size_t size() const { return shards.size(); }
+
+            const std::vector<T> &boundaries() const { return bounds; }
+
+            tree_type &tree(std::size_t i) { return *shards[i]->tree; }
+
+            // Ordered scan over every shard in turn.
+            iterator begin() {
+                iterator it(this, 0, shards[0]->tree->begin());
+                it.skip();
+                return it;
+            }
+
+            iterator end() {
+                return iterator(this, shards.size(), shards.back()->tree->end());
+            }
+
+            iterator find(const T &key) {
+                std::size_t i = shard_of(key);
+                iterator it(this, i, shards[i]->tree->find(key));
+                if (it.it == shards[i]->tree->end()) return end();
+                return it;
+            }
+
+        private:
+            struct shard {
+                long id;
+                std::shared_ptr<pagemanager> pm;
+                std::unique_ptr<tree_type> tree;
+                std::mutex mutex;
+                std::atomic<long> writes{0};
+            };
+
+            std::string prefix;
+            long next_id = 0;
+            std::vector<T> bounds;
+            std::vector<std::unique_ptr<shard>> shards;
+
+            std::string file_of(long id) const {
+                return prefix + "." + std::to_string(id) + ".index";
+            }
+
+            shard *open_shard(long id, bool create) {
+                shard *s = new shard;
+                s->id = id;
+                s->pm = std::make_shared<pagemanager>(file_of(id), create);
+                s->tree.reset(new tree_type(s->pm));
+                return s;
+            }
+
+            // Layout file: next id, shard count, shard ids, then the bounds.
+            void save_layout() {
+                std::string tmp = prefix + ".shards.tmp";
+                {
+                    std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+                    long n = shards.size();
+                    out.write((const char *) &next_id, sizeof(next_id));
+                    out.write((const char *) &n, sizeof(n));
+                    for (auto &s : shards) out.write((const char *) &s->id, sizeof(s->id));
+                    if (!bounds.empty()) out.write((const char *) bounds.data(), bounds.size() * sizeof(T));
+                    out.close();
+                    if (!out) {
+                        std::remove(tmp.c_str());
+                        throw std::runtime_error("cannot write " + tmp);
+                    }
+                }
+                if (std::rename(tmp.c_str(), (prefix + ".shards").c_str()) != 0) {
+                    std::remove(tmp.c_str());
+                    throw std::runtime_error("cannot rename " + tmp + " to " + prefix + ".shards");
+                }
+            }
+
+            bool load_layout() {
+                std::ifstream in((prefix + ".shards").c_str(), std::ios::binary);
+                long n = 0;
+                if (!in.read((char *) &next_id, sizeof(next_id)) || !in.read((char *) &n, sizeof(n)) || n <= 0) {
+                    next_id = 0;
+                    return false;
+                }
+                std::vector<long> ids(n);
+                bounds.resize(n - 1);
+                in.read((char *) ids.data(), n * sizeof(long));
+                if (n > 1) in.read((char *) bounds.data(), (n - 1) * sizeof(T));
+                if (!in) throw std::runtime_error("truncated shard layout " + prefix + ".shards");
+                for (long id : ids) shards.emplace_back(open_shard(id, false));
+                for (std::size_t i = 0; i < bounds.size(); i++) trim(i);
+                return true;
+            }
+
+            // Removes the keys of shard `i` at or above its bound, left there
+            // by a split() cut short after saving the layout.
+            void trim(std::size_t i) {
+                tree_type &t = *shards[i]->tree;
+                std::vector<T> stale;
+                for (auto it = t.lower_bound(bounds[i]); it != t.end(); ++it) stale.push_back(*it);
+                for (const T &key : stale) t.remove(key);
+            }
+        };
+
+    } // namespace disk
+
+} // namespace utec
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace utec {
+
+    namespace disk {
+
+        // I/O and structural counters plus per-operation latency histograms.
+        // Every thread writes to its own shard with relaxed atomics, so
+        // recording never takes a lock; snap() sums the shards.
+        class statistics {
+        public:
+            enum counter {
+                PAGES_READ,
+                PAGES_WRITTEN,
+                BYTES_READ,
+                BYTES_WRITTEN,
+                CACHE_HITS,
+                SPLITS,
+                ROOT_SPLITS,
+                ROTATE_LEFT,
+                ROTATE_RIGHT,
+                MERGES,
+                ROOT_MERGES,
+                BLOOM_NEGATIVES,
+                APPENDS,
+                HASH_HITS,
+                WRITE_CALLS,
+                COUNTERS,
+            };
+
+            enum operation {
+                OP_INSERT,
+                OP_REMOVE,
+                OP_FIND,
+                OPERATIONS,
+            };
+
+            // Log-linear buckets: exact below 8, then 8 sub-buckets per power
+            // of two, which bounds the relative error to 12.5%.
+            enum histogram_layout {
+                SUB_BITS = 3,
+                SUB_COUNT = 1 << SUB_BITS,
+                BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT,
+                SHARDS = 16,
+            };
+
+            static int bucket_of(uint64_t v) {
+                if (v < SUB_COUNT) return v;
+                int msb = 63 - __builtin_clzll(v);
+                int sub = (v >> (msb - SUB_BITS)) & (SUB_COUNT - 1);
+                return (msb - SUB_BITS + 1) * SUB_COUNT + sub;
+            }
+
+            static uint64_t bucket_low(int b) {
+                if (b < SUB_COUNT) return b;
+                int msb = b / SUB_COUNT + SUB_BITS - 1;
+                return uint64_t(SUB_COUNT + b % SUB_COUNT) << (msb - SUB_BITS);
+            }
+
+            static uint64_t bucket_high(int b) {
+                if (b < SUB_COUNT) return b;
+                int msb = b / SUB_COUNT + SUB_BITS - 1;
+                return bucket_low(b) + (uint64_t(1) << (msb - SUB_BITS)) - 1;
+            }
+
+            struct histogram {
+                std::vector<uint64_t> buckets;
+                uint64_t count = 0;
+                uint64_t sum = 0;
+                uint64_t max = 0;
+
+                histogram() : buckets(BUCKETS, 0) {}
+
+                double mean() const {
+                    return count ? double(sum) / count : 0;
+                }
+
+                // Upper bound of the bucket holding the q-th quantile.
+                uint64_t percentile(double q) const {
+                    if (!count) return 0;
+                    uint64_t rank = uint64_t(q * (count - 1)) + 1, seen = 0;
+                    for (int b = 0; b < BUCKETS; b++) {
+                        seen += buckets[b];
+                        if (seen >= rank) return std::min(bucket_high(b), max);
+                    }
+                    return max;
+                }
+            };
+
+            struct snapshot {
+                uint64_t counters[COUNTERS];
+                histogram latency[OPERATIONS];
+
+                std::string to_json() const {
+                    std::ostringstream out;
+                    out << "{\"counters\":{";
+                    for (int c = 0; c < COUNTERS; c++) {
+                        out << (c ? "," : "") << '"' << counter_name(c) << "\":" << counters[c];
+                    }
+                    out << "},\"latency_ns\":{";
+                    for (int op = 0; op < OPERATIONS; op++) {
+                        const histogram &h = latency[op];
+                        out << (op ? "," : "") << '"' << operation_name(op) << "\":{"
+                            << "\"count\":" << h.count
+                            << ",\"mean\":" << h.mean()
+                            << ",\"p50\":" << h.percentile(0.5)
+                            << ",\"p99\":" << h.percentile(0.99)
+                            << ",\"p999\":" << h.percentile(0.999)
+                            << ",\"max\":" << h.max << '}';
+                    }
+                    out << "}}";
+                    return out.str();
+                }
+
+                std::string to_prometheus(const std::string &prefix = "bstar") const {
+                    std::ostringstream out;
+                    for (int c = 0; c < COUNTERS; c++) {
+                        std::string name = prefix + "_" + counter_name(c) + "_total";
+                        out << "# TYPE " << name << " counter\n"
+                            << name << ' ' << counters[c] << '\n';
+                    }
+                    std::string name = prefix + "_operation_latency_seconds";
+                    out << "# TYPE " << name << " summary\n";
+                    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+                    for (int op = 0; op < OPERATIONS; op++) {
+                        const histogram &h = latency[op];
+                        std::string label = std::string("op=\"") + operation_name(op) + "\"";
+                        for (double q : quantiles) {
+                            out << name << '{' << label << ",quantile=\"" << q << "\"} "
+                                << h.percentile(q) / 1e9 << '\n';
+                        }
+                        out << name << "_sum{" << label << "} " << h.sum / 1e9 << '\n'
+                            << name << "_count{" << label << "} " << h.count << '\n';
+                    }
+                    return out.str();
+                }
+            };
+
+            class timer {
+            public:
+                timer(statistics &s, operation op) :
+                    s(s), op(op), start(std::chrono::steady_clock::now()) {}
+
+                ~timer() {
+                    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+                    s.record(op, ns);
+                }
+
+            private:
+                statistics &s;
+                operation op;
+                std::chrono::steady_clock::time_point start;
+            };
+
+            statistics() : shards(new shard[SHARDS]) {
+                reset();
+            }
+
+            ~statistics() {
+                delete[] shards;
+            }
+
+            statistics(const statistics &) = delete;
+            statistics &operator=(const statistics &) = delete;
+
+            void add(counter c, uint64_t n = 1) {
+                local().counters[c].fetch_add(n, std::memory_order_relaxed);
+            }
+
+            void record(operation op, uint64_t ns) {
+                shard &s = local();
+                s.buckets[op][bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+                s.sum[op].fetch_add(ns, std::memory_order_relaxed);
+                uint64_t m = s.max[op].load(std::memory_order_relaxed);
+                while (ns > m && !s.max[op].compare_exchange_weak(m, ns, std::memory_order_relaxed));
+            }
+
+            snapshot snap() const {
+                snapshot out;
+                for (int c = 0; c < COUNTERS; c++) out.counters[c] = 0;
+                for (int i = 0; i < SHARDS; i++) {
+                    const shard &s = shards[i];
+                    for (int c = 0; c < COUNTERS; c++) {
+                        out.counters[c] += s.counters[c].load(std::memory_order_relaxed);
+                    }
+                    for (int op = 0; op < OPERATIONS; op++) {
+                        histogram &h = out.latency[op];
+                        for (int b = 0; b < BUCKETS; b++) {
+                            uint64_t n = s.buckets[op][b].load(std::memory_order_relaxed);
+                            h.buckets[b] += n;
+                            h.count += n;
+                        }
+                        h.sum += s.sum[op].load(std::memory_order_relaxed);
+                        h.max = std::max(h.max, (uint64_t) s.max[op].load(std::memory_order_relaxed));
+                    }
+                }
+                return out;
+            }
+
+            void reset() {
+                for (int i = 0; i < SHARDS; i++) {
+                    shard &s = shards[i];
+                    for (int c = 0; c < COUNTERS; c++) s.counters[c].store(0, std::memory_order_relaxed);
+                    for (int op = 0; op < OPERATIONS; op++) {
+                        for (int b = 0; b < BUCKETS; b++) s.buckets[op][b].store(0, std::memory_order_relaxed);
+                        s.sum[op].store(0, std::memory_order_relaxed);
+                        s.max[op].store(0, std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            static const char *counter_name(int c) {
+                static const char *names[] = {
+                    "pages_read", "pages_written", "bytes_read", "bytes_written",
+                    "cache_hits", "splits", "root_splits", "rotate_left", "rotate_right",
+                    "merges", "root_merges", "bloom_negatives", "appends", "hash_hits",
+                    "write_calls",
+                };
+                return names[c];
+            }
+
+            static const char *operation_name(int op) {
+                static const char *names[] = {"insert", "remove", "find"};
+                return names[op];
+            }
+
+        private:
+            struct shard {
+                std::atomic<uint64_t> counters[COUNTERS];
+                std::atomic<uint64_t> buckets[OPERATIONS][BUCKETS];
+                std::atomic<uint64_t> sum[OPERATIONS];
+                std::atomic<uint64_t> max[OPERATIONS];
+                char pad[64];
+            };
+
+            shard *shards;
+
+            shard &local() {
+                static std::atomic<unsigned> next{0};
+                static thread_local unsigned slot = next.fetch_add(1);
+                return shards[slot % SHARDS];
+            }
+        };
+
+    } // namespace disk
+
+} // namespace utec
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+namespace utec {
+
+    // Default ordering of the trees: `<` on whatever pair of types it is
+    // given, so a lookup may pass a type ordered against the key (a C
+    // string for a std::string key, say) without converting it.
+    struct less {
+        typedef void is_transparent;
+
+        template <class A, class B>
+        bool operator()(const A &a, const B &b) const { return a < b; }
+    };
+
+    // Encodes a tuple of integers and strings into bytes whose memcmp
+    // order is the tuple's order, so a multi-column key compares with one
+    // byte compare instead of a field-by-field one:
+    //
+    //   - an integer takes sizeof(I) bytes, big-endian, with the sign bit
+    //     flipped for signed types;
+    //   - a string takes its bytes, each 0x00 escaped as 0x00 0xff, and
+    //     ends with 0x00 0x00, which sorts below any byte it could meet.
+    //
+    // Columns are not tagged, so keys compared with each other must be
+    // encoded from the same column types.
+    class key_encoder {
+    public:
+        template <class I>
+        typename std::enable_if<std::is_integral<I>::value && !std::is_same<I, bool>::value, key_encoder &>::type
+        add(I value) {
+            typedef typename std::make_unsigned<I>::type U;
+            U u = (U) value;
+            if (std::is_signed<I>::value) u ^= U(1) << (sizeof(U) * 8 - 1);
+            for (int shift = (sizeof(U) - 1) * 8; shift >= 0; shift -= 8) out.push_back((char) (u >> shift));
+            return *this;
+        }
+
+        key_encoder &add(const char *data, std::size_t size) {
+            for (std::size_t i = 0; i < size; i++) {
+                out.push_back(data[i]);
+                if (!data[i]) out.push_back('\xff');
+            }
+            out.append(2, '\0');
+            return *this;
+        }
+
+        key_encoder &add(const std::string &s) { return add(s.data(), s.size()); }
+
+        key_encoder &add(const char *s) { return add(s, std::strlen(s)); }
+
+        key_encoder &add_all() { return *this; }
+
+        template <class Column, class... Rest>
+        key_encoder &add_all(const Column &column, const Rest &... rest) {
+            add(column);
+            return add_all(rest...);
+        }
+
+        const std::string &bytes() const { return out; }
+
+        std::size_t size() const { return out.size(); }
+
+        void clear() { out.clear(); }
+
+    private:
+        std::string out;
+    };
+
+    // Reads back the columns of a key_encoder image, in the order and
+    // with the types they were added with.
+    class key_decoder {
+    public:
+        key_decoder(const void *data, std::size_t size) :
+            p(static_cast<const unsigned char *>(data)), end(p + size) {}
+
+        explicit key_decoder(const std::string &bytes) : key_decoder(bytes.data(), bytes.size()) {}
+
+        template <class I>
+        typename std::enable_if<std::is_integral<I>::value && !std::is_same<I, bool>::value, I>::type get() {
+            typedef typename std::make_unsigned<I>::type U;
+            if (std::size_t(end - p) < sizeof(U)) throw std::invalid_argument("key ends inside an integer column");
+            U u = 0;
+            for (std::size_t i = 0; i < sizeof(U); i++) u = (U) (u << 8 | *p++);
+            if (std::is_signed<I>::value) u ^= U(1) << (sizeof(U) * 8 - 1);
+            return (I) u;
+        }
+
+        std::string get_string() {
+            std::string s;
+            while (true) {
+                if (end - p < 2) throw std::invalid_argument("key ends inside a string column");
+                if (!p[0] && !p[1]) break;
+                s.push_back((char) *p);
+                p += p[0] ? 1 : 2;
+            }
+            p += 2;
+            return s;
+        }
+
+        // Bytes not read yet; padding of a packed_key shows up here.
+        std::size_t left() const { return end - p; }
+
+    private:
+        const unsigned char *p;
+        const unsigned char *end;
+    };
+
+    // Fixed-width key of encoded bytes for trees that store keys on
+    // pages. The image is padded with `fill`: 0x00 gives the smallest key
+    // starting with it and 0xff the largest, which bound a prefix scan.
+    template <std::size_t N>
+    struct packed_key {
+        unsigned char bytes[N];
+
+        static packed_key of(const std::string &encoded, unsigned char fill = 0) {
+            if (encoded.size() > N) {
+                throw std::length_error("encoded key of " + std::to_string(encoded.size()) +
+                                        " bytes does not fit in " + std::to_string(N));
+            }
+            packed_key k;
+            std::memcpy(k.bytes, encoded.data(), encoded.size());
+            std::memset(k.bytes + encoded.size(), fill, N - encoded.size());
+            return k;
+        }
+
+        // The decoder points into this key, which must outlive it.
+        key_decoder columns() const & { return key_decoder(bytes, N); }
+        key_decoder columns() const && = delete;
+    };
+
+    template <std::size_t N>
+    bool operator<(const packed_key<N> &a, const packed_key<N> &b) { return std::memcmp(a.bytes, b.bytes, N) < 0; }
+
+    template <std::size_t N>
+    bool operator<=(const packed_key<N> &a, const packed_key<N> &b) { return std::memcmp(a.bytes, b.bytes, N) <= 0; }
+
+    template <std::size_t N>
+    bool operator==(const packed_key<N> &a, const packed_key<N> &b) { return std::memcmp(a.bytes, b.bytes, N) == 0; }
+
+    template <std::size_t N>
+    bool operator!=(const packed_key<N> &a, const packed_key<N> &b) { return std::memcmp(a.bytes, b.bytes, N) != 0; }
+
+    template <class... Columns>
+    std::string encode_key(const Columns &... columns) {
+        key_encoder e;
+        return e.add_all(columns...).bytes();
+    }
+
+    template <std::size_t N, class... Columns>
+    packed_key<N> pack_key(const Columns &... columns) {
+        return packed_key<N>::of(encode_key(columns...));
+    }
+
+} // namespace utec
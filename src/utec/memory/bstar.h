@@ -1,8 +1,17 @@
 #pragma once
 
+#include "../keys.h"
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 
 using namespace std;
 
@@ -10,7 +19,11 @@ namespace utec {
 
     namespace memory {
 
-        template <class T, int BTREE_ORDER = 3>
+        // With COUNTED every node also tracks the number of keys below it,
+        // which rank(), select() and count_range() walk in O(log n).
+        // Keys are ordered by Compare alone; two keys are equal when neither
+        // precedes the other.
+        template <class T, int BTREE_ORDER = 3, bool COUNTED = false, class Compare = utec::less>
         class bstar {
         private:
             enum state {
@@ -25,21 +38,59 @@ namespace utec {
                 T_BLOCK = (2*BTREE_ORDER)/3,
             };
 
+            enum image {
+                IMAGE_VERSION = 1,
+                IMAGE_BATCH = 4096,
+            };
+
+            enum {
+                // Nodes have at least two children, so this bounds the
+                // height of any tree that fits in memory.
+                MAX_DEPTH = 64,
+            };
+
+            // save() writes this header followed by the keys in ascending
+            // order; the image holds no pointers and does not depend on
+            // BTREE_ORDER.
+            struct image_header {
+                char magic[8];
+                uint32_t version;
+                uint32_t key_size;
+                uint64_t count;
+            };
+
             struct Node {
                 vector<T> keys;
                 vector<Node*> children;
                 bool isLeaf;
+                long size = 0;
 
                 Node(bool isLeaf): isLeaf(isLeaf){}
             };
 
             Node* root;
+            Compare comp;
+
+            void recount(Node* node){
+                if(!COUNTED) return;
+                node->size = node->keys.size();
+                if(!node->isLeaf)
+                    for(auto child : node->children) node->size += child->size;
+            }
 
-            bool find(T data, Node* &node, int &i){
+            // With a transparent Compare, lookups may pass any type ordered
+            // against T without building a T.
+            template <class K>
+            bool same(const K &a, const T &b) {
+                return !comp(a, b) && !comp(b, a);
+            }
+
+            template <class K>
+            bool find(const K &data, Node* &node, int &i){
                 while(node){
                     for(i=0; i<node->keys.size(); ++i) {
-                        if(data==node->keys[i]) return true;
-                        else if(data<node->keys[i]) break;
+                        if(comp(data, node->keys[i])) break;
+                        else if(!comp(node->keys[i], data)) return true;
                     }
                     if(!node->isLeaf) node = node->children[i];
                     else node = 0;
@@ -48,7 +99,8 @@ namespace utec {
             }
 
             void insKeys(Node* &node1, Node* &node2, int pos){
-                node1->keys.insert(node1->keys.begin(),node2->keys.begin()+pos+1,node2->keys.end());
+                node1->keys.insert(node1->keys.begin(),make_move_iterator(node2->keys.begin()+pos+1),
+                                   make_move_iterator(node2->keys.end()));
                 node2->keys.erase(node2->keys.begin()+pos,node2->keys.end());
             }
 
@@ -58,13 +110,16 @@ namespace utec {
             }
 
             void rotate(Node* &node, Node* n1, Node* n2, int n3, int pos1, int pos2, int pos3, int pos4){
-                n1->keys.insert(n1->keys.begin()+pos2,node->keys[n3]);
-                node->keys[n3] = n2->keys[pos1];
+                n1->keys.insert(n1->keys.begin()+pos2,std::move(node->keys[n3]));
+                node->keys[n3] = std::move(n2->keys[pos1]);
                 n2->keys.erase(n2->keys.begin()+pos1);
                 if(!n1->isLeaf) {
                     n1->children.insert(n1->children.begin()+pos2+pos3,n2->children[pos1+pos4]);
                     n2->children.erase(n2->children.begin()+pos1+pos4);
                 }
+                recount(n1);
+                recount(n2);
+                recount(node);
             }
 
             void merge(Node* node, Node* n1, Node* n2, Node* n3, int pos){
@@ -74,17 +129,19 @@ namespace utec {
 
                 // JOIN TO SPLIT
 
-                keys.insert(keys.end(), n1->keys.begin(), n1->keys.end());
+                keys.reserve(n1->keys.size() + n2->keys.size() + n3->keys.size() + 2);
+
+                keys.insert(keys.end(), make_move_iterator(n1->keys.begin()), make_move_iterator(n1->keys.end()));
                 children.insert(children.end(), n1->children.begin(), n1->children.end());
 
-                keys.insert(keys.end(), node->keys[pos]);
+                keys.insert(keys.end(), std::move(node->keys[pos]));
 
-                keys.insert(keys.end(), n2->keys.begin(), n2->keys.end());
+                keys.insert(keys.end(), make_move_iterator(n2->keys.begin()), make_move_iterator(n2->keys.end()));
                 children.insert(children.end(), n2->children.begin(), n2->children.end());
 
-                keys.insert(keys.end(), node->keys[pos+1]);
+                keys.insert(keys.end(), std::move(node->keys[pos+1]));
 
-                keys.insert(keys.end(), n3->keys.begin(), n3->keys.end());
+                keys.insert(keys.end(), make_move_iterator(n3->keys.begin()), make_move_iterator(n3->keys.end()));
                 children.insert(children.end(), n3->children.begin(), n3->children.end());
 
                 // EMPTY VECTORS KEYS AND CHILDREN
@@ -94,13 +151,15 @@ namespace utec {
 
                 // SPLIT
 
-                n1->keys.insert(n1->keys.end(), keys.begin(), keys.begin() + BTREE_ORDER - 1);
+                n1->keys.insert(n1->keys.end(), make_move_iterator(keys.begin()),
+                                make_move_iterator(keys.begin() + BTREE_ORDER - 1));
                 if(!children.empty())
                     n1->children.insert(n1->children.end(), children.begin(), children.begin() + BTREE_ORDER);
 
-                node->keys[pos] = keys[BTREE_ORDER - 1];
+                node->keys[pos] = std::move(keys[BTREE_ORDER - 1]);
 
-                n2->keys.insert(n2->keys.end(), keys.begin() + BTREE_ORDER, keys.end());
+                n2->keys.insert(n2->keys.end(), make_move_iterator(keys.begin() + BTREE_ORDER),
+                                make_move_iterator(keys.end()));
                 if(!children.empty())
                     n2->children.insert(n2->children.end(), children.begin() + BTREE_ORDER, children.end());
 
@@ -110,18 +169,22 @@ namespace utec {
                 node->children.erase(node->children.begin() + pos + 2);
                 node->keys.erase(node->keys.begin() + pos + 1);
 
+                recount(n1);
+                recount(n2);
+
             }
 
             void mergeRoot(Node* node, Node* n1, Node* n2){
 
-                n1->keys.insert(n1->keys.end(), node->keys[0]);
-                n1->keys.insert(n1->keys.end(), n2->keys.begin(), n2->keys.end());
+                n1->keys.insert(n1->keys.end(), std::move(node->keys[0]));
+                n1->keys.insert(n1->keys.end(), make_move_iterator(n2->keys.begin()), make_move_iterator(n2->keys.end()));
                 n1->children.insert(n1->children.end(), n2->children.begin(), n2->children.end());
 
                 delete node->children[1];
                 delete root;
 
                 this->root = n1;
+                recount(n1);
 
             }
 
@@ -141,26 +204,30 @@ namespace utec {
 
                 node->children.insert(node->children.begin()+sidx+1,tnode);
 
-                snode->keys.insert(snode->keys.begin(),node->keys[fidx]);
-                node->keys[fidx] = *(fnode->keys.begin()+F_BLOCK);
+                snode->keys.insert(snode->keys.begin(),std::move(node->keys[fidx]));
+                node->keys[fidx] = std::move(fnode->keys[F_BLOCK]);
 
                 insKeys(snode,fnode,F_BLOCK);
                 if(!snode->isLeaf) {
                     inschildren(snode,fnode,F_BLOCK);
                 }
 
-                node->keys.insert(node->keys.begin()+sidx,*(snode->keys.begin()+S_BLOCK));
+                node->keys.insert(node->keys.begin()+sidx,std::move(snode->keys[S_BLOCK]));
 
                 insKeys(tnode,snode,S_BLOCK);
                 if(!tnode->isLeaf) {
                     inschildren(tnode,snode,S_BLOCK);
                 }
+
+                recount(fnode);
+                recount(snode);
+                recount(tnode);
             }
 
             int insert(T &data, Node* &node){
                 int i;
                 for(i=0; i<node->keys.size(); ++i)
-                    if(data<=node->keys[i]) break;
+                    if(!comp(node->keys[i], data)) break;
                 if(!node->isLeaf){
                     auto temp = node->children[i];
                     int status = insert(data,temp);
@@ -177,26 +244,29 @@ namespace utec {
                         }
                         split(node,i);
                     }
-                } else node->keys.insert(node->keys.begin()+i,data);
+                } else node->keys.insert(node->keys.begin()+i,std::move(data));
+                recount(node);
                 if(node->keys.size()==BTREE_ORDER){
                     return BT_OVERFLOW;
                 }
                 return NORMAL;
             }
 
-            bool remove(T data, T* &temp, Node* &node){
+            template <class K>
+            bool remove(const K &data, T* &temp, Node* &node){
                 int i;
                 for(i=0; i<node->keys.size(); ++i){
-                    if(data<=node->keys[i]) break;
+                    if(!comp(node->keys[i], data)) break;
                 }
                 if(node->isLeaf){
-                    if(data != node->keys[i] && !temp) return false;
+                    if(!temp && (i == node->keys.size() || !same(data, node->keys[i]))) return false;
                     if(i==node->keys.size()) --i;
-                    if(temp && *temp != node->keys[i]) swap(*temp,node->keys[i]);
+                    if(temp) swap(*temp,node->keys[i]);
                     node->keys.erase(node->keys.begin()+i);
+                    recount(node);
                     return true;
                 }
-                if(i<node->keys.size() && data == node->keys[i]) temp=&node->keys[i];
+                if(i<node->keys.size() && same(data, node->keys[i])) temp=&node->keys[i];
                 if(!remove(data,temp,node->children[i])) return false;
                 auto size=node->children[i]->keys.size();
                 
@@ -222,6 +292,7 @@ namespace utec {
 
                             if(node == root && node->keys.size() == 1) {
                                 mergeRoot(node, node->children[0], node->children[1]);
+                                return true;
                             } else {
                                 merge(node, node->children[i], node->children[i+1], node->children[i+2], i);
                             }
@@ -248,6 +319,7 @@ namespace utec {
 
                             if(node == root && node->keys.size() == 1) {
                                 mergeRoot(node, node->children[0], node->children[1]);
+                                return true;
                             } else {
                                 merge(node, node->children[i-2], node->children[i-1], node->children[i], i-2);
                             }
@@ -270,6 +342,7 @@ namespace utec {
 
                             if(node == root && node->keys.size() == 1) {
                                 mergeRoot(node, node->children[0], node->children[1]);
+                                return true;
                             } else {
                                 merge(node, node->children[i-1], node->children[i], node->children[i+1], i-1);
                             }
@@ -278,6 +351,7 @@ namespace utec {
 
                     }
                 }
+                recount(node);
                 return true;
             }
 
@@ -290,6 +364,91 @@ namespace utec {
                 if(!node->isLeaf) traverseInOrder(node->children[i]);
             }
 
+            long rank(const T &k, bool inclusive) {
+                static_assert(COUNTED, "rank queries need a bstar with COUNTED set");
+                long r = 0;
+                Node* node = root;
+                while(node){
+                    int i = 0;
+                    while(i < node->keys.size() && (inclusive ? !comp(k, node->keys[i]) : comp(node->keys[i], k))){
+                        r += (node->isLeaf ? 0 : node->children[i]->size) + 1;
+                        i++;
+                    }
+                    node = node->isLeaf ? 0 : node->children[i];
+                }
+                return r;
+            }
+
+            template <class F>
+            void for_each(Node* node, F &f) {
+                int i;
+                for(i=0; i<node->keys.size(); ++i){
+                    if(!node->isLeaf) for_each(node->children[i], f);
+                    f(node->keys[i]);
+                }
+                if(!node->isLeaf) for_each(node->children[i], f);
+            }
+
+            // Builds the tree bottom-up over the sorted `items`. Each level
+            // is cut into the fewest nodes of at most BTREE_ORDER-1 keys,
+            // spread evenly, with one key between neighbours moving up;
+            // the level that fits in a root becomes the root.
+            void build(vector<T> &items){
+                vector<Node*> below;
+                while(items.size() > F_BLOCK*2){
+                    long n = items.size();
+                    long m = (n + BTREE_ORDER) / BTREE_ORDER;
+                    long per = (n - m + 1) / m, extra = (n - m + 1) % m;
+                    bool leaf = below.empty();
+                    vector<T> up;
+                    vector<Node*> nodes;
+                    up.reserve(m - 1);
+                    nodes.reserve(m);
+                    long pos = 0, child = 0;
+                    for(long j=0; j<m; j++){
+                        long c = per + (j < extra);
+                        Node* node = new Node(leaf);
+                        node->keys.assign(make_move_iterator(items.begin()+pos),
+                                          make_move_iterator(items.begin()+pos+c));
+                        pos += c;
+                        if(!leaf){
+                            node->children.assign(below.begin()+child, below.begin()+child+c+1);
+                            child += c+1;
+                        }
+                        recount(node);
+                        nodes.push_back(node);
+                        if(j+1 < m) up.push_back(std::move(items[pos++]));
+                    }
+                    items.swap(up);
+                    below.swap(nodes);
+                }
+                root = new Node(below.empty());
+                root->keys.swap(items);
+                root->children.swap(below);
+                recount(root);
+            }
+
+            // First slot of `node` whose key is not below `k` (or, with
+            // `after`, is above it).
+            template <class K>
+            int slot(Node* node, const K &k, bool after) {
+                if(after) return std::upper_bound(node->keys.begin(), node->keys.end(), k, comp) - node->keys.begin();
+                return std::lower_bound(node->keys.begin(), node->keys.end(), k, comp) - node->keys.begin();
+            }
+
+            // Visits the keys of `node` in [lo, hi]; false once past `hi`.
+            template <class F>
+            bool for_each_in_range(Node* node, const T &lo, const T &hi, F &f) {
+                int i;
+                for(i=slot(node, lo, false); i<node->keys.size(); ++i){
+                    if(!node->isLeaf && !for_each_in_range(node->children[i], lo, hi, f)) return false;
+                    if(comp(hi, node->keys[i])) return false;
+                    f(node->keys[i]);
+                }
+                if(!node->isLeaf) return for_each_in_range(node->children[i], lo, hi, f);
+                return true;
+            }
+
             void deleteAll(Node* node){
                 int i;
                 for(i=0; i<node->keys.size(); ++i){
@@ -315,23 +474,232 @@ namespace utec {
             }
 
         public:
-            bstar() : root(nullptr) {
+            // Bidirectional iterator over the keys in ascending order. It
+            // keeps the path from the root as a fixed stack of (node, slot)
+            // frames: the top frame points at the current key, the others
+            // at the child being walked. Any insert, remove, update or load
+            // invalidates it.
+            class iterator {
+            public:
+                typedef std::bidirectional_iterator_tag iterator_category;
+                typedef T value_type;
+                typedef std::ptrdiff_t difference_type;
+                typedef const T* pointer;
+                typedef const T& reference;
+
+                iterator() : tree(nullptr), depth(0) {}
+
+                reference operator*() const { return path[depth-1].node->keys[path[depth-1].i]; }
+
+                pointer operator->() const { return &**this; }
+
+                iterator &operator++() {
+                    frame &top = path[depth-1];
+                    if(!top.node->isLeaf){
+                        top.i++;
+                        leftmost(top.node->children[top.i]);
+                        return *this;
+                    }
+                    if(++top.i < top.node->keys.size()) return *this;
+                    depth--;
+                    ascend();
+                    return *this;
+                }
+
+                iterator operator++(int) {
+                    iterator old = *this;
+                    ++*this;
+                    return old;
+                }
+
+                // Stepping back from end() lands on the largest key.
+                iterator &operator--() {
+                    if(!depth){
+                        rightmost(tree->root);
+                        return *this;
+                    }
+                    frame &top = path[depth-1];
+                    if(!top.node->isLeaf){
+                        rightmost(top.node->children[top.i]);
+                        return *this;
+                    }
+                    if(top.i-- > 0) return *this;
+                    depth--;
+                    while(depth && path[depth-1].i == 0) depth--;
+                    if(depth) path[depth-1].i--;
+                    return *this;
+                }
+
+                iterator operator--(int) {
+                    iterator old = *this;
+                    --*this;
+                    return old;
+                }
+
+                // Moves forward to the first key not below `k`; never moves
+                // back. Climbs only to the nearest frame whose pending key
+                // is not below `k` and searches down again from the child
+                // under it, so a short hop stays in the current leaf.
+                template <class K>
+                void advance_to(const K &k) {
+                    if(!depth || !tree->comp(**this, k)) return;
+                    int level = depth - 1;
+                    while(level > 0){
+                        frame &up = path[level-1];
+                        if(up.i < up.node->keys.size() && !tree->comp(up.node->keys[up.i], k)) break;
+                        level--;
+                    }
+                    depth = level;
+                    tree->descend(*this, path[level].node, k, false);
+                }
+
+                bool operator==(const iterator &other) const {
+                    if(!depth || !other.depth) return depth == other.depth;
+                    return path[depth-1].node == other.path[other.depth-1].node &&
+                           path[depth-1].i == other.path[other.depth-1].i;
+                }
+
+                bool operator!=(const iterator &other) const { return !(*this == other); }
+
+            private:
+                friend class bstar;
+
+                struct frame {
+                    Node* node;
+                    int i;
+                };
+
+                bstar* tree;
+                int depth;
+                frame path[MAX_DEPTH];
+
+                explicit iterator(bstar* tree) : tree(tree), depth(0) {}
+
+                void push(Node* node, int i) {
+                    path[depth].node = node;
+                    path[depth].i = i;
+                    depth++;
+                }
+
+                void leftmost(Node* node) {
+                    while(!node->isLeaf){
+                        push(node, 0);
+                        node = node->children[0];
+                    }
+                    push(node, 0);
+                    if(node->keys.empty()) ascend_from_empty();
+                }
+
+                void rightmost(Node* node) {
+                    while(!node->isLeaf){
+                        push(node, node->keys.size());
+                        node = node->children.back();
+                    }
+                    push(node, (int) node->keys.size() - 1);
+                    if(node->keys.empty()) ascend_from_empty();
+                }
+
+                // Only an empty root leaf has no keys.
+                void ascend_from_empty() {
+                    depth--;
+                    ascend();
+                }
+
+                // Pops the frames whose last child is done; the frame left
+                // on top, if any, points at the next key.
+                void ascend() {
+                    while(depth && path[depth-1].i == path[depth-1].node->keys.size()) depth--;
+                }
+            };
+
+            typedef iterator const_iterator;
+
+            explicit bstar(const Compare &comp = Compare()) : root(nullptr), comp(comp) {
                 root = new Node(BTREE_ORDER);
             }
 
-            bool search(T k) {
+            template <class K>
+            bool search(const K &k) {
                 auto temp = root; int i;
                 return find(k,temp,i);
             }
 
-            void insert(T k) {
+            Compare key_comp() const {
+                return comp;
+            }
+
+            // Copies the stored element equal to `k` into `out`.
+            template <class K>
+            bool lookup(const K &k, T &out) {
+                auto temp = root; int i;
+                if(!find(k,temp,i)) return false;
+                out = temp->keys[i];
+                return true;
+            }
+
+            // Replaces the stored element equal to `value` in place; the
+            // ordering of `value` must not differ from the one it replaces.
+            bool update(const T &value) {
+                auto temp = root; int i;
+                if(!find(value,temp,i)) return false;
+                temp->keys[i] = value;
+                return true;
+            }
+
+            // Calls f(key) for every key in ascending order.
+            template <class F>
+            void for_each(F f) {
+                for_each(root, f);
+            }
+
+            iterator begin() {
+                iterator it(this);
+                it.leftmost(root);
+                return it;
+            }
+
+            iterator end() {
+                return iterator(this);
+            }
+
+            // First key not below `k`.
+            template <class K>
+            iterator lower_bound(const K &k) {
+                return bound(k, false);
+            }
+
+            // First key above `k`.
+            template <class K>
+            iterator upper_bound(const K &k) {
+                return bound(k, true);
+            }
+
+            template <class K>
+            std::pair<iterator, iterator> equal_range(const K &k) {
+                return std::make_pair(lower_bound(k), upper_bound(k));
+            }
+
+            // Calls f(key) for every key in [lo, hi] in ascending order,
+            // skipping the subtrees outside the range.
+            template <class F>
+            void for_each_in_range(const T &lo, const T &hi, F f) {
+                if(comp(hi, lo)) return;
+                for_each_in_range(root, lo, hi, f);
+            }
+
+            void insert(const T &k) {
+                T copy(k);
+                insert(std::move(copy));
+            }
+
+            void insert(T &&k) {
                 auto temp = root;
                 insert(k,temp);
                 if(root->keys.size() > F_BLOCK*2){
                     Node* newRoot = new Node(false);
                     Node* newNode = new Node(root->isLeaf);
 
-                    newRoot->keys.push_back(temp->keys[F_BLOCK]);
+                    newRoot->keys.push_back(std::move(temp->keys[F_BLOCK]));
                     newRoot->children.push_back(root);
                     newRoot->children.push_back(newNode);
 
@@ -340,16 +708,137 @@ namespace utec {
                         inschildren(newNode,root,F_BLOCK);
                     }
 
+                    recount(root);
+                    recount(newNode);
+                    recount(newRoot);
                     root = newRoot;
                 }
             }
 
-            bool remove(T k) {
+            // Number of keys smaller than `k`.
+            long rank(const T &k) {
+                return rank(k, false);
+            }
+
+            // Copies the k-th smallest key (from 0) into `out`.
+            bool select(long k, T &out) {
+                static_assert(COUNTED, "select needs a bstar with COUNTED set");
+                if(k < 0 || k >= root->size) return false;
+                Node* node = root;
+                while(true){
+                    for(int i=0; i<=node->keys.size(); i++){
+                        long below = node->isLeaf ? 0 : node->children[i]->size;
+                        if(k < below){
+                            node = node->children[i];
+                            break;
+                        }
+                        k -= below;
+                        if(i < node->keys.size() && k-- == 0){
+                            out = node->keys[i];
+                            return true;
+                        }
+                    }
+                }
+            }
+
+            // Number of keys in [lo, hi].
+            long count_range(const T &lo, const T &hi) {
+                if(comp(hi, lo)) return 0;
+                return rank(hi, true) - rank(lo, false);
+            }
+
+            long size() {
+                static_assert(COUNTED, "size needs a bstar with COUNTED set");
+                return root->size;
+            }
+
+            // Constructs the key in place from `args` and inserts it.
+            template <class... Args>
+            void emplace(Args&&... args) {
+                insert(T(std::forward<Args>(args)...));
+            }
+
+            template <class K>
+            bool remove(const K &k) {
                 T *temp=0;
                 Node *node=root;
                 return remove(k,temp,node);
             }
 
+            // Replaces the contents with the sorted `keys` in linear time.
+            void bulk_load(vector<T> keys) {
+                for(std::size_t i=1; i<keys.size(); i++)
+                    if(comp(keys[i], keys[i-1])) throw std::invalid_argument("bulk_load keys are not sorted");
+                deleteAll(root);
+                build(keys);
+            }
+
+            // Writes every key to `path` as a versioned image that load()
+            // reads back. The file is replaced only once it is complete.
+            void save(const string &path) {
+                static_assert(std::is_trivially_copyable<T>::value, "save needs trivially copyable keys");
+                string tmp = path + ".tmp";
+                image_header h;
+                std::memset(&h, 0, sizeof(h));
+                std::memcpy(h.magic, "UTECMBS", 8);
+                h.version = IMAGE_VERSION;
+                h.key_size = sizeof(T);
+                {
+                    std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+                    out.write((const char *) &h, sizeof(h));
+                    vector<T> batch;
+                    batch.reserve(IMAGE_BATCH);
+                    for_each([&](const T &k){
+                        batch.push_back(k);
+                        if(batch.size() == IMAGE_BATCH){
+                            out.write((const char *) batch.data(), batch.size() * sizeof(T));
+                            h.count += batch.size();
+                            batch.clear();
+                        }
+                    });
+                    out.write((const char *) batch.data(), batch.size() * sizeof(T));
+                    h.count += batch.size();
+                    out.seekp(0);
+                    out.write((const char *) &h, sizeof(h));
+                    out.flush();
+                    if(!out) {
+                        std::remove(tmp.c_str());
+                        throw std::runtime_error("cannot write " + tmp);
+                    }
+                }
+                if(std::rename(tmp.c_str(), path.c_str()) != 0) {
+                    std::remove(tmp.c_str());
+                    throw std::runtime_error("cannot rename " + tmp + " to " + path);
+                }
+            }
+
+            // Replaces the contents with the image at `path`: one sequential
+            // read, then a linear bottom-up build. The tree is left as it
+            // was if the image is missing or malformed.
+            void load(const string &path) {
+                static_assert(std::is_trivially_copyable<T>::value, "load needs trivially copyable keys");
+                std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+                if(!in) throw std::runtime_error("cannot open " + path);
+                uint64_t bytes = in.tellg();
+                in.seekg(0);
+                image_header h;
+                if(bytes < sizeof(h) || !in.read((char *) &h, sizeof(h)) || std::memcmp(h.magic, "UTECMBS", 8) != 0)
+                    throw std::runtime_error(path + " is not a bstar image");
+                if(h.version != IMAGE_VERSION)
+                    throw std::runtime_error("unsupported bstar image version " + std::to_string(h.version));
+                if(h.key_size != sizeof(T))
+                    throw std::runtime_error(path + " holds keys of " + std::to_string(h.key_size) + " bytes");
+                if(h.count != (bytes - sizeof(h)) / sizeof(T) || (bytes - sizeof(h)) % sizeof(T))
+                    throw std::runtime_error("truncated bstar image " + path);
+                vector<T> items(h.count);
+                if(h.count && !in.read((char *) items.data(), h.count * sizeof(T)))
+                    throw std::runtime_error("truncated bstar image " + path);
+                for(std::size_t i=1; i<items.size(); i++)
+                    if(comp(items[i], items[i-1])) throw std::runtime_error("unsorted bstar image " + path);
+                deleteAll(root);
+                build(items);
+            }
+
             void print() {
                 traverseInOrder(root);
                 cout << endl;
@@ -363,6 +852,27 @@ namespace utec {
             ~bstar(){
                 deleteAll(root);
             }
+
+        private:
+            // Pushes the slots slot() picks from `node` down to a leaf, then
+            // pops the frames left with nothing after them.
+            template <class K>
+            void descend(iterator &it, Node* node, const K &k, bool after) {
+                while(true){
+                    int i = slot(node, k, after);
+                    it.push(node, i);
+                    if(node->isLeaf) break;
+                    node = node->children[i];
+                }
+                it.ascend();
+            }
+
+            template <class K>
+            iterator bound(const K &k, bool after) {
+                iterator it(this);
+                descend(it, root, k, after);
+                return it;
+            }
         };
     }
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <type_traits>
+
+namespace utec {
+
+    // Streaming set operations over two ordered trees (disk or memory
+    // bstar, in any mix) holding the same key type and ordering; `a`'s
+    // key_comp() decides. Results reach `out(key)` in ascending order and
+    // can be fed straight to the bulk_load() of a result tree.
+    //
+    // Keys that repeat are matched pairwise, as in std::set_intersection
+    // and friends. Where one side only has to catch up with the other, its
+    // iterator jumps with advance_to(): the hop stays inside the current
+    // leaf when it can and otherwise reads one path, so subtrees lying
+    // wholly between two keys of the other side are never read.
+
+    // Keys in both `a` and `b`.
+    template <class TreeA, class TreeB, class F>
+    void intersect(TreeA &a, TreeB &b, F out) {
+        typedef typename std::decay<decltype(*a.begin())>::type key;
+        auto comp = a.key_comp();
+        auto i = a.begin(), i_end = a.end();
+        auto j = b.begin(), j_end = b.end();
+        while(i != i_end && j != j_end){
+            key x = *i, y = *j;
+            if(comp(x, y)) i.advance_to(y);
+            else if(comp(y, x)) j.advance_to(x);
+            else {
+                out(x);
+                ++i;
+                ++j;
+            }
+        }
+    }
+
+    // Keys in `a` or `b`, a key in both once. Every key is visited, so
+    // nothing is skipped.
+    template <class TreeA, class TreeB, class F>
+    void unite(TreeA &a, TreeB &b, F out) {
+        typedef typename std::decay<decltype(*a.begin())>::type key;
+        auto comp = a.key_comp();
+        auto i = a.begin(), i_end = a.end();
+        auto j = b.begin(), j_end = b.end();
+        while(i != i_end && j != j_end){
+            key x = *i, y = *j;
+            if(comp(x, y)){
+                out(x);
+                ++i;
+            } else if(comp(y, x)){
+                out(y);
+                ++j;
+            } else {
+                out(x);
+                ++i;
+                ++j;
+            }
+        }
+        for(; i != i_end; ++i) out(*i);
+        for(; j != j_end; ++j) out(*j);
+    }
+
+    // Keys in `a` but not in `b`. `b` is only probed at the keys of `a`.
+    template <class TreeA, class TreeB, class F>
+    void difference(TreeA &a, TreeB &b, F out) {
+        typedef typename std::decay<decltype(*a.begin())>::type key;
+        auto comp = a.key_comp();
+        auto i = a.begin(), i_end = a.end();
+        auto j = b.begin(), j_end = b.end();
+        for(; i != i_end; ++i){
+            key x = *i;
+            if(j != j_end) j.advance_to(x);
+            if(j == j_end || comp(x, *j)) out(x);
+            else ++j;
+        }
+    }
+
+} // namespace utec
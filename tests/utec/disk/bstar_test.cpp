@@ -5,9 +5,20 @@
 #include <gtest/gtest.h>
 #include <utec/disk/bstar.h>
 #include <utec/disk/pagemanager.h>
+#include <utec/keys.h>
+#include <utec/memory/bstar.h>
+#include <utec/setops.h>
 
 #include <fmt/core.h>
 
+#include <csignal>
+#include <fstream>
+#include <functional>
+#include <set>
+#include <tuple>
+
+#include <sys/resource.h>
+
 // PAGE_SIZE 64 bytes
 #define PAGE_SIZE  128
 
@@ -83,3 +94,749 @@ TEST_F(DiskBasedBstar, Scalability) {
     bt.insert(c);
   }*/
 }
+
+TEST_F(DiskBasedBstar, Reorganize) {
+  std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_reorg.index", true);
+  bstar<int, BSTAR_ORDER> bt(pm);
+  std::vector<int> values;
+  for(int i = 0; i < 2000; i++) {
+    values.push_back((i * 7919) % 2003);
+    bt.insert(values.back());
+  }
+  for(int i = 0; i < 500; i++) {
+    EXPECT_TRUE(bt.remove(values[i]));
+  }
+  values.erase(values.begin(), values.begin() + 500);
+
+  int calls = 1;
+  while(!bt.reorganize(32)) calls++;
+  EXPECT_GT(calls, 1);
+  EXPECT_TRUE(bt.reorganize(0));
+
+  for(int i = 0; i < 300; i++) {
+    values.push_back(5000 + i);
+    bt.insert(values.back());
+  }
+  while(!bt.reorganize(32));
+
+  std::sort(values.begin(), values.end());
+  std::ostringstream out, expected;
+  bt.print(out);
+  for(auto v : values) expected << v;
+  EXPECT_EQ(out.str(), expected.str());
+}
+
+TEST_F(DiskBasedBstar, Statistics) {
+  std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_stats.index", true);
+  bstar<int, BSTAR_ORDER> bt(pm);
+  bt.stats().reset();
+  for(int i = 0; i < 1000; i++) bt.insert(i);
+  for(int i = 0; i < 600; i++) bt.remove(i);
+
+  statistics::snapshot s = bt.stats().snap();
+  EXPECT_GT(s.counters[statistics::PAGES_READ], 0u);
+  EXPECT_GT(s.counters[statistics::PAGES_WRITTEN], 0u);
+  EXPECT_GT(s.counters[statistics::SPLITS], 0u);
+  EXPECT_GT(s.counters[statistics::ROOT_SPLITS], 0u);
+  EXPECT_GT(s.counters[statistics::ROTATE_LEFT], 0u);
+  EXPECT_GT(s.counters[statistics::MERGES], 0u);
+  EXPECT_EQ(s.latency[statistics::OP_INSERT].count, 1000u);
+  EXPECT_EQ(s.latency[statistics::OP_REMOVE].count, 600u);
+  EXPECT_LE(s.latency[statistics::OP_INSERT].percentile(0.5), s.latency[statistics::OP_INSERT].max);
+
+  EXPECT_NE(s.to_json().find("\"pages_read\":"), std::string::npos);
+  EXPECT_NE(s.to_prometheus().find("bstar_splits_total"), std::string::npos);
+
+  bt.stats().reset();
+  s = bt.stats().snap();
+  EXPECT_EQ(s.counters[statistics::PAGES_READ], 0u);
+  EXPECT_EQ(s.latency[statistics::OP_INSERT].count, 0u);
+}
+
+TEST_F(DiskBasedBstar, BloomFilter) {
+  {
+    std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_bloom.index", true);
+    bstar<int, BSTAR_ORDER> bt(pm);
+    for(int i = 0; i < 2000; i += 2) bt.insert(i);
+    bt.enable_bloom(10);
+    for(int i = 2000; i < 20000; i += 2) bt.insert(i);
+    for(int i = 0; i < 20000; i += 4) bt.remove(i);
+
+    bt.stats().reset();
+    for(int i = 1; i < 20000; i += 2) EXPECT_TRUE(bt.find(i) == bt.end());
+    statistics::snapshot s = bt.stats().snap();
+    EXPECT_GT(s.counters[statistics::BLOOM_NEGATIVES], 9000u);
+    for(int i = 0; i < 20000; i += 2) EXPECT_EQ(bt.find(i) != bt.end(), i % 4 != 0);
+  }
+
+  std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_bloom.index");
+  bstar<int, BSTAR_ORDER> bt(pm);
+  bt.stats().reset();
+  for(int i = 1; i < 20000; i += 2) EXPECT_TRUE(bt.find(i) == bt.end());
+  statistics::snapshot s = bt.stats().snap();
+  EXPECT_GT(s.counters[statistics::BLOOM_NEGATIVES], 9000u);
+  EXPECT_LT(s.counters[statistics::PAGES_READ] + s.counters[statistics::CACHE_HITS], 2000u);
+
+  bt.disable_bloom();
+  bt.stats().reset();
+  EXPECT_TRUE(bt.find(1) == bt.end());
+  EXPECT_EQ(bt.stats().snap().counters[statistics::BLOOM_NEGATIVES], 0u);
+}
+
+TEST_F(DiskBasedBstar, OrderStatistics) {
+  std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_rank.index", true);
+  bstar<int, BSTAR_ORDER, true> bt(pm);
+  std::vector<int> keys;
+  for(int i = 0; i < 3000; i++) {
+    int k = (i * 7919) % 3001;
+    bt.insert(k);
+    keys.push_back(k);
+  }
+  for(int i = 0; i < 1500; i++) {
+    int k = (i * 104729) % 3001;
+    auto it = std::find(keys.begin(), keys.end(), k);
+    EXPECT_EQ(bt.remove(k), it != keys.end());
+    if(it != keys.end()) keys.erase(it);
+  }
+  std::sort(keys.begin(), keys.end());
+
+  EXPECT_EQ(bt.size(), (long) keys.size());
+  for(int k = -1; k <= 3001; k += 7) {
+    EXPECT_EQ(bt.rank(k), std::lower_bound(keys.begin(), keys.end(), k) - keys.begin());
+  }
+  for(long i = 0; i < (long) keys.size(); i += 13) {
+    int out;
+    EXPECT_TRUE(bt.select(i, out));
+    EXPECT_EQ(out, keys[i]);
+  }
+  int out;
+  EXPECT_FALSE(bt.select(keys.size(), out));
+  EXPECT_EQ(bt.count_range(100, 199),
+            std::upper_bound(keys.begin(), keys.end(), 199) - std::lower_bound(keys.begin(), keys.end(), 100));
+  EXPECT_EQ(bt.count_range(5, 4), 0);
+
+  bt.stats().reset();
+  bt.count_range(250, 750);
+  statistics::snapshot s = bt.stats().snap();
+  EXPECT_LT(s.counters[statistics::PAGES_READ] + s.counters[statistics::CACHE_HITS], 20u);
+}
+
+TEST_F(DiskBasedBstar, BulkLoad) {
+  for(int n : {0, 1, 10, 11, 12, 100, 5000}) {
+    std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_bulk.index", true);
+    bstar<int, BSTAR_ORDER, true> bt(pm);
+    std::vector<int> keys;
+    for(int i = 0; i < n; i++) keys.push_back(2 * i);
+    bt.bulk_load(keys, n % 2 ? 1.0 : 0.8);
+    EXPECT_EQ(bt.size(), n);
+
+    std::vector<int> scanned;
+    for(auto it = bt.begin(); it != bt.end(); ++it) scanned.push_back(*it);
+    EXPECT_EQ(scanned, keys);
+    for(int i = 0; i < n; i += 7) {
+      int out;
+      EXPECT_TRUE(bt.select(i, out));
+      EXPECT_EQ(out, keys[i]);
+      EXPECT_EQ(bt.rank(2 * i + 1), i + 1);
+    }
+
+    for(int i = 0; i < n; i += 3) bt.insert(2 * i + 1);
+    for(int i = 0; i < n; i += 2) EXPECT_TRUE(bt.remove(2 * i));
+    std::vector<int> expected;
+    for(int i = 0; i < n; i++) {
+      if(i % 2) expected.push_back(2 * i);
+      if(i % 3 == 0) expected.push_back(2 * i + 1);
+    }
+    std::sort(expected.begin(), expected.end());
+    scanned.clear();
+    for(auto it = bt.begin(); it != bt.end(); ++it) scanned.push_back(*it);
+    EXPECT_EQ(scanned, expected);
+    EXPECT_EQ(bt.size(), (long) expected.size());
+  }
+
+  std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_bulk.index", true);
+  bstar<int, BSTAR_ORDER> bt(pm);
+  bt.insert(1);
+  EXPECT_THROW(bt.bulk_load(std::vector<int>{2, 3}), std::logic_error);
+}
+
+// Pages a tree has touched since its counters were reset, from the file
+// or the cache.
+template <class Tree>
+uint64_t page_accesses(Tree &bt) {
+  statistics::snapshot s = bt.stats().snap();
+  return s.counters[statistics::PAGES_READ] + s.counters[statistics::CACHE_HITS];
+}
+
+struct RangeSummary {
+  long count = 0;
+  long sum = 0;
+  int first = 0;
+  int last = 0;
+
+  void operator()(int key) {
+    if(!count) first = key;
+    last = key;
+    count++;
+    sum += key;
+  }
+};
+
+TEST_F(DiskBasedBstar, ParallelScan) {
+  std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_pscan.index", true);
+  bstar<int, BSTAR_ORDER> bt(pm);
+  for(int i = 0; i < 20000; i++) bt.insert((i * 7919) % 20011);
+
+  std::vector<RangeSummary> parts = bt.parallel_scan(1000, 15000, 4, RangeSummary());
+  EXPECT_GT(parts.size(), 1u);
+  EXPECT_LE(parts.size(), 4u);
+  long count = 0, sum = 0;
+  for(std::size_t p = 0; p < parts.size(); p++) {
+    EXPECT_GT(parts[p].count, 0);
+    if(p) {
+      EXPECT_LT(parts[p-1].last, parts[p].first);
+    }
+    count += parts[p].count;
+    sum += parts[p].sum;
+  }
+  long expected = 0, expected_sum = 0;
+  for(int i = 0; i < 20000; i++) {
+    int k = (i * 7919) % 20011;
+    if(k >= 1000 && k <= 15000) {
+      expected++;
+      expected_sum += k;
+    }
+  }
+  EXPECT_EQ(count, expected);
+  EXPECT_EQ(sum, expected_sum);
+  EXPECT_EQ(parts.front().first, 1000);
+
+  RangeSummary serial;
+  bt.scan(1000, 15000, serial);
+  EXPECT_EQ(serial.count, expected);
+  EXPECT_EQ(serial.last, parts.back().last);
+
+  EXPECT_EQ(bt.parallel_scan(30000, 40000, 4, RangeSummary()).size(), 1u);
+}
+
+TEST_F(DiskBasedBstar, DeleteRange) {
+  std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_range.index", true);
+  bstar<int, BSTAR_ORDER, true> bt(pm);
+  std::set<int> expected;
+  for(int i = 0; i < 20000; i++) {
+    int k = (i * 7919) % 20011;
+    bt.insert(k);
+    expected.insert(k);
+  }
+  long pages = bt.header.size;
+
+  for(auto range : std::vector<std::pair<int, int>>{{5000, 14999}, {100, 100}, {-10, 40}, {19990, 30000}, {7, 3}}) {
+    bt.delete_range(range.first, range.second);
+    if(range.first <= range.second) {
+      expected.erase(expected.lower_bound(range.first), expected.upper_bound(range.second));
+    }
+    std::vector<int> scanned;
+    for(auto it = bt.begin(); it != bt.end(); ++it) scanned.push_back(*it);
+    EXPECT_EQ(scanned, std::vector<int>(expected.begin(), expected.end()));
+    EXPECT_EQ(bt.size(), (long) expected.size());
+    EXPECT_TRUE(bt.verify(2).ok());
+  }
+  EXPECT_LT(bt.header.size, pages / 2);
+
+  // The tree stays balanced enough for ordinary updates.
+  for(int k = 5000; k < 6000; k++) {
+    bt.insert(k);
+    expected.insert(k);
+  }
+  for(int k = 0; k < 5000; k += 2) {
+    if(expected.erase(k)) {
+      EXPECT_TRUE(bt.remove(k));
+    }
+  }
+  std::vector<int> scanned;
+  for(auto it = bt.begin(); it != bt.end(); ++it) scanned.push_back(*it);
+  EXPECT_EQ(scanned, std::vector<int>(expected.begin(), expected.end()));
+  EXPECT_TRUE(bt.verify(2).ok());
+
+  // Freed pages are reused.
+  long before = bt.header.count;
+  bt.clear();
+  EXPECT_TRUE(bt.begin() == bt.end());
+  EXPECT_EQ(bt.size(), 0);
+  for(int k = 0; k < 1000; k++) bt.insert(k);
+  EXPECT_EQ(bt.size(), 1000);
+  EXPECT_LE(bt.header.count, before);
+}
+
+TEST_F(DiskBasedBstar, DeferredRebalance) {
+  uint64_t written[2];
+  for(int relaxed = 0; relaxed < 2; relaxed++) {
+    std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_deferred.index", true);
+    bstar<int, BSTAR_ORDER> bt(pm);
+    std::vector<int> keys;
+    for(int i = 0; i < 20000; i++) keys.push_back(2 * i);
+    bt.bulk_load(keys);
+    if(relaxed) bt.defer_rebalance(1);
+
+    bt.stats().reset();
+    std::vector<int> expected;
+    for(int i = 0; i < 20000; i++) {
+      int k = (i * 7919) % 20000;
+      if(k % 3) expected.push_back(2 * k);
+      else EXPECT_TRUE(bt.remove(2 * k));
+    }
+    written[relaxed] = bt.stats().snap().counters[statistics::PAGES_WRITTEN];
+    std::sort(expected.begin(), expected.end());
+
+    if(relaxed) {
+      EXPECT_GT(bt.deferred_nodes(), 0u);
+      bt.compact();
+      EXPECT_EQ(bt.deferred_nodes(), 0u);
+      // Checked against the eager fill bounds.
+      bt.defer_rebalance(BSTAR_ORDER);
+      EXPECT_TRUE(bt.verify(2).ok());
+    }
+    std::vector<int> scanned;
+    for(auto it = bt.begin(); it != bt.end(); ++it) scanned.push_back(*it);
+    EXPECT_EQ(scanned, expected);
+
+    for(int i = 0; i < 1000; i++) bt.insert(2 * i + 1);
+    for(int i = 1; i < 3000; i += 3) EXPECT_TRUE(bt.remove(2 * i));
+    long n = 0;
+    for(auto it = bt.begin(); it != bt.end(); ++it) n++;
+    EXPECT_EQ(n, (long) expected.size());
+  }
+  // About one leaf write per removed key instead of the whole path.
+  EXPECT_LT(written[1] * 2, written[0]);
+}
+
+TEST_F(DiskBasedBstar, AppendFastPath) {
+  uint64_t written[2], read[2];
+  long pages[2];
+  for(int ascending = 0; ascending < 2; ascending++) {
+    std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_append.index", true);
+    bstar<int, BSTAR_ORDER> bt(pm);
+    bt.stats().reset();
+    for(int i = 0; i < 20000; i++) bt.insert(ascending ? i : 20000 - i);
+    statistics::snapshot s = bt.stats().snap();
+    written[ascending] = s.counters[statistics::PAGES_WRITTEN];
+    read[ascending] = s.counters[statistics::PAGES_READ];
+    pages[ascending] = bt.header.size;
+    if(ascending) EXPECT_GT(s.counters[statistics::APPENDS], 19000u);
+    else EXPECT_EQ(s.counters[statistics::APPENDS], 0u);
+
+    // Random inserts and removes still work around the thin right edge.
+    for(int i = 0; i < 2000; i++) bt.insert(40000 + (i * 7919) % 2000 * 2);
+    for(int i = 0; i < 20000; i += 3) EXPECT_TRUE(bt.remove(ascending ? i : 20000 - i));
+    for(int i = 0; i < 1000; i++) bt.insert(50000 + i);
+    std::vector<int> expected, scanned;
+    for(int i = 0; i < 20000; i++) if(i % 3) expected.push_back(ascending ? i : 20000 - i);
+    for(int i = 0; i < 2000; i++) expected.push_back(40000 + 2 * i);
+    for(int i = 0; i < 1000; i++) expected.push_back(50000 + i);
+    std::sort(expected.begin(), expected.end());
+    for(auto it = bt.begin(); it != bt.end(); ++it) scanned.push_back(*it);
+    EXPECT_EQ(scanned, expected);
+  }
+  // Appended leaves are left nearly full instead of about 2/3 full.
+  EXPECT_LT(pages[1] * 6, pages[0] * 5);
+  EXPECT_LT(written[1] * 2, written[0]);
+  EXPECT_LT(read[1] * 2, read[0]);
+}
+
+TEST_F(DiskBasedBstar, InsertReadsOnlyItsPath) {
+  std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_path.index", true);
+  bstar<int, BSTAR_ORDER> bt(pm);
+  std::vector<int> keys;
+  for(int i = 0; i < 20000; i++) keys.push_back(4 * i);
+  bt.bulk_load(keys, 0.7);
+
+  // A lookup of an absent key reads exactly one root-to-leaf path.
+  bt.stats().reset();
+  for(int i = 0; i < 2000; i++) bt.find((i * 7919) % 20000 * 4 + 1);
+  uint64_t path = page_accesses(bt);
+
+  // Leaves have room, so no insert overflows: no sibling is read and only
+  // the leaf is written.
+  bt.stats().reset();
+  for(int i = 0; i < 2000; i++) bt.insert((i * 7919) % 20000 * 4 + 1);
+  statistics::snapshot s = bt.stats().snap();
+  EXPECT_EQ(s.counters[statistics::SPLITS] + s.counters[statistics::ROTATE_LEFT] +
+            s.counters[statistics::ROTATE_RIGHT], 0u);
+  EXPECT_EQ(page_accesses(bt), path);
+  EXPECT_EQ(s.counters[statistics::PAGES_WRITTEN], 2000u);
+
+  long n = 0;
+  for(auto it = bt.begin(); it != bt.end(); ++it) n++;
+  EXPECT_EQ(n, 22000);
+}
+
+TEST_F(DiskBasedBstar, ChecksumsAndVerify) {
+  typedef bstar<int, BSTAR_ORDER> int_bstar;
+  long root_id;
+  {
+    std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_verify.index", true);
+    int_bstar bt(pm);
+    for(int i = 0; i < 5000; i++) bt.insert((i * 7919) % 5000);
+    for(int i = 0; i < 5000; i += 4) EXPECT_TRUE(bt.remove(i));
+    int_bstar::report r = bt.verify(4);
+    EXPECT_TRUE(r.ok());
+    for(auto &e : r.errors) std::cout << e << std::endl;
+    EXPECT_EQ(r.keys, 3750);
+    EXPECT_GT(r.free, 0);
+    EXPECT_EQ(r.pages, r.nodes - 1 + r.free);
+    root_id = bt.header.root_id;
+  }
+  {
+    // Flip one bit of a key in the root page.
+    std::fstream f("bstar_verify.index", std::ios::in | std::ios::out | std::ios::binary);
+    long at = root_id * sizeof(int_bstar::Node<2 * int_bstar::F_BLOCK>) + sizeof(long) * 3 + sizeof(uint32_t);
+    char c;
+    f.seekg(at);
+    f.get(c);
+    f.seekp(at);
+    f.put(c ^ 1);
+  }
+  std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_verify.index");
+  int_bstar bt(pm);
+  EXPECT_THROW(bt.find(1), std::runtime_error);
+  int_bstar::report r = bt.verify(2);
+  ASSERT_EQ(r.errors.size(), 1u);
+  EXPECT_NE(r.errors[0].find("checksum"), std::string::npos);
+}
+
+TEST_F(DiskBasedBstar, AdaptiveHashIndex) {
+  std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_hash.index", true);
+  bstar<int, BSTAR_ORDER> bt(pm);
+  std::vector<int> keys;
+  for(int i = 0; i < 20000; i++) keys.push_back(4 * i);
+  bt.bulk_load(keys, 0.7);
+  bt.enable_hash_index(64);
+
+  int found;
+  for(int round = 0; round < 3; round++) {
+    for(int i = 0; i < 50; i++) EXPECT_TRUE(bt.lookup((i * 397) % 20000 * 4, found));
+  }
+  EXPECT_EQ(bt.hash_index_size(), 50u);
+  bt.stats().reset();
+  for(int i = 0; i < 50; i++) {
+    EXPECT_TRUE(bt.lookup((i * 397) % 20000 * 4, found));
+    EXPECT_EQ(found, (i * 397) % 20000 * 4);
+  }
+  EXPECT_EQ(bt.stats().snap().counters[statistics::HASH_HITS], 50u);
+  EXPECT_EQ(page_accesses(bt), 50u);
+
+  // find() answers from the index too; an iterator it places walks on
+  // like one from a descent.
+  bt.stats().reset();
+  for(int i = 0; i < 50; i++) {
+    int key = (i * 397) % 20000 * 4;
+    auto it = bt.find(key);
+    EXPECT_EQ(*it, key);
+    if(key < 4 * 19997) {
+      ++it;
+      EXPECT_EQ(*it, key + 4);
+      it.advance_to(key + 12);
+      EXPECT_EQ(*it, key + 12);
+    }
+  }
+  EXPECT_EQ(bt.stats().snap().counters[statistics::HASH_HITS], 50u);
+  EXPECT_TRUE(bt.find(20000 * 4) == bt.end());
+  for(int round = 0; round < 3; round++) bt.find(8);
+  EXPECT_EQ(*bt.find(8), 8);
+  EXPECT_EQ(bt.stats().snap().counters[statistics::HASH_HITS], 51u);
+
+  // Splits, rotations and merges move hot keys to other pages; their
+  // entries must not be trusted afterwards.
+  for(int i = 0; i < 20000; i++) bt.insert(4 * i + 1);
+  for(int i = 0; i < 20000; i += 2) EXPECT_TRUE(bt.remove(4 * i + 1));
+  for(int i = 0; i < 50; i += 5) EXPECT_TRUE(bt.remove((i * 397) % 20000 * 4));
+  for(int i = 0; i < 50; i++) {
+    int key = (i * 397) % 20000 * 4;
+    EXPECT_EQ(bt.lookup(key, found), i % 5 != 0);
+    if(i % 5) {
+      EXPECT_EQ(found, key);
+    }
+  }
+
+  // The index stays within its capacity.
+  for(int round = 0; round < 3; round++) {
+    for(int i = 0; i < 500; i++) bt.lookup(8 * i, found);
+  }
+  EXPECT_LE(bt.hash_index_size(), 64u);
+  bt.disable_hash_index();
+  EXPECT_EQ(bt.hash_index_size(), 0u);
+}
+
+TEST_F(DiskBasedBstar, CompositeKeys) {
+  typedef utec::packed_key<24> key;
+  std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_composite.index", true);
+  bstar<key, 5> bt(pm);
+  std::set<std::tuple<int, long, std::string>> expected;
+  for(int i = 0; i < 3000; i++) {
+    int tenant = i % 7 - 3;
+    long ts = (i * 7919L) % 100003 - 50000;
+    std::string name = fmt::format("n{}", i % 13);
+    bt.insert(utec::pack_key<24>(tenant, ts, name));
+    expected.insert(std::make_tuple(tenant, ts, name));
+  }
+
+  auto want = expected.begin();
+  for(auto it = bt.begin(); it != bt.end(); ++it, ++want) {
+    key k = *it;
+    utec::key_decoder columns = k.columns();
+    int tenant = columns.get<int>();
+    long ts = columns.get<long>();
+    std::string name = columns.get_string();
+    EXPECT_EQ(std::make_tuple(tenant, ts, name), *want);
+  }
+  EXPECT_TRUE(want == expected.end());
+
+  // Padding with 0x00 and 0xff bounds every key with a given prefix.
+  long tenant_one = 0, window = 0;
+  struct counter {
+    long &n;
+    void operator()(const key &) { n++; }
+  };
+  counter all{tenant_one}, recent{window};
+  bt.scan(key::of(utec::encode_key(1)), key::of(utec::encode_key(1), 0xff), all);
+  bt.scan(key::of(utec::encode_key(2, -1000L)), key::of(utec::encode_key(2, 1000L), 0xff), recent);
+  long expected_one = 0, expected_window = 0;
+  for(auto &t : expected) {
+    if(std::get<0>(t) == 1) expected_one++;
+    if(std::get<0>(t) == 2 && std::get<1>(t) >= -1000 && std::get<1>(t) <= 1000) expected_window++;
+  }
+  EXPECT_EQ(tenant_one, expected_one);
+  EXPECT_EQ(window, expected_window);
+  EXPECT_TRUE(bt.find(utec::pack_key<24>(-3, -50000L, "n0")) != bt.end());
+  EXPECT_THROW(utec::pack_key<24>(1, 2L, "a name far too long for the key"), std::length_error);
+}
+
+TEST_F(DiskBasedBstar, CustomComparator) {
+  std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_greater.index", true);
+  bstar<int, BSTAR_ORDER, true, std::greater<int>> bt(pm);
+  for(int i = 0; i < 2000; i++) bt.insert((i * 7919) % 2003);
+  std::vector<int> keys;
+  for(auto it = bt.begin(); it != bt.end(); ++it) keys.push_back(*it);
+  EXPECT_EQ(keys.size(), 2000u);
+  EXPECT_TRUE(std::is_sorted(keys.begin(), keys.end(), std::greater<int>()));
+  EXPECT_TRUE(bt.find(1000) != bt.end());
+  EXPECT_EQ(bt.rank(1000), std::count_if(keys.begin(), keys.end(), [](int k) { return k > 1000; }));
+  EXPECT_TRUE(bt.remove(1000));
+  EXPECT_TRUE(bt.find(1000) == bt.end());
+  EXPECT_TRUE(bt.verify().ok());
+}
+
+TEST_F(DiskBasedBstar, SetOperations) {
+  std::shared_ptr<pagemanager> big_pm = std::make_shared<pagemanager>("bstar_setops_big.index", true);
+  std::shared_ptr<pagemanager> small_pm = std::make_shared<pagemanager>("bstar_setops_small.index", true);
+  bstar<int, BSTAR_ORDER> big(big_pm), small(small_pm);
+  std::vector<int> many, few;
+  for(int i = 0; i < 20000; i++) many.push_back(3 * i);
+  for(int i = 0; i < 40; i++) few.push_back(i * 1499);
+  big.bulk_load(many);
+  small.bulk_load(few);
+  EXPECT_EQ(*big.lower_bound(4), 6);
+  EXPECT_TRUE(big.lower_bound(60000) == big.end());
+
+  big.stats().reset();
+  long n = 0;
+  for(auto it = big.begin(); it != big.end(); ++it) n++;
+  uint64_t full_scan = page_accesses(big);
+
+  std::vector<int> got, want;
+  big.stats().reset();
+  utec::intersect(small, big, [&got](int k) { got.push_back(k); });
+  std::set_intersection(few.begin(), few.end(), many.begin(), many.end(), std::back_inserter(want));
+  EXPECT_EQ(got, want);
+  EXPECT_LT(page_accesses(big) * 10, full_scan);
+
+  got.clear();
+  want.clear();
+  big.stats().reset();
+  utec::difference(small, big, [&got](int k) { got.push_back(k); });
+  std::set_difference(few.begin(), few.end(), many.begin(), many.end(), std::back_inserter(want));
+  EXPECT_EQ(got, want);
+  EXPECT_LT(page_accesses(big) * 10, full_scan);
+
+  got.clear();
+  want.clear();
+  utec::unite(big, small, [&got](int k) { got.push_back(k); });
+  std::set_union(many.begin(), many.end(), few.begin(), few.end(), std::back_inserter(want));
+  EXPECT_EQ(got, want);
+
+  // Trees of both kinds mix; the result goes straight into a new tree.
+  utec::memory::bstar<int, 7> staged;
+  std::set<int> staged_keys;
+  for(int i = 0; i < 5000; i++) {
+    staged.insert(i * 7 % 5003);
+    staged_keys.insert(i * 7 % 5003);
+  }
+  got.clear();
+  want.clear();
+  utec::difference(big, staged, [&got](int k) { got.push_back(k); });
+  std::shared_ptr<pagemanager> out_pm = std::make_shared<pagemanager>("bstar_setops_out.index", true);
+  bstar<int, BSTAR_ORDER> result(out_pm);
+  result.bulk_load(got);
+  long kept = 0;
+  for(auto it = result.begin(); it != result.end(); ++it) kept++;
+  std::set_difference(many.begin(), many.end(), staged_keys.begin(), staged_keys.end(), std::back_inserter(want));
+  EXPECT_EQ(kept, (long) want.size());
+}
+
+static long file_size(const char *path) {
+  std::ifstream f(path, std::ios::binary | std::ios::ate);
+  return f.tellg();
+}
+
+TEST_F(DiskBasedBstar, ExportImport) {
+  std::vector<long> keys;
+  for(long i = 0, k = -50000; i < 20000; i++, k += 1 + (i * 7919) % 13) keys.push_back(k);
+  keys.push_back(1L << 40);
+  {
+    std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_export.index", true);
+    bstar<long, BSTAR_ORDER> bt(pm);
+    for(std::size_t i = 0; i < keys.size(); i++) bt.insert(keys[(i * 7907) % keys.size()]);
+    EXPECT_EQ(bt.export_keys("bstar_delta.image", true, 256), (long) keys.size());
+    EXPECT_EQ(bt.export_keys("bstar_raw.image", false, 4096), (long) keys.size());
+  }
+  EXPECT_LT(file_size("bstar_delta.image") * 3, file_size("bstar_raw.image"));
+
+  for(const char *image : {"bstar_delta.image", "bstar_raw.image"}) {
+    std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_import.index", true);
+    bstar<long, BSTAR_ORDER, true> bt(pm);
+    EXPECT_EQ(bt.import_keys(image), (long) keys.size());
+    EXPECT_EQ(bt.size(), (long) keys.size());
+    std::vector<long> scanned;
+    for(auto it = bt.begin(); it != bt.end(); ++it) scanned.push_back(*it);
+    EXPECT_EQ(scanned, keys);
+    EXPECT_THROW(bt.import_keys(image), std::logic_error);
+  }
+
+  {
+    typedef utec::packed_key<8> key;
+    std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_export.index", true);
+    bstar<key, BSTAR_ORDER> bt(pm);
+    for(int i = 0; i < 500; i++) bt.insert(utec::pack_key<8>(i % 7, i));
+    EXPECT_EQ(bt.export_keys("bstar_packed.image"), 500);
+    std::shared_ptr<pagemanager> pm2 = std::make_shared<pagemanager>("bstar_import.index", true);
+    bstar<key, BSTAR_ORDER> copy(pm2);
+    EXPECT_EQ(copy.import_keys("bstar_packed.image"), 500);
+    auto it = copy.begin();
+    for(auto jt = bt.begin(); jt != bt.end(); ++jt, ++it) EXPECT_TRUE(*it == *jt);
+    EXPECT_TRUE(it == copy.end());
+  }
+
+  {
+    std::fstream f("bstar_delta.image", std::ios::in | std::ios::out | std::ios::binary);
+    f.seekp(file_size("bstar_delta.image") / 2);
+    f.put('\x5a');
+  }
+  std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("bstar_import.index", true);
+  bstar<long, BSTAR_ORDER> bt(pm);
+  EXPECT_THROW(bt.import_keys("bstar_delta.image"), std::runtime_error);
+  EXPECT_THROW(bt.import_keys("bstar_missing.image"), std::runtime_error);
+  std::shared_ptr<pagemanager> pm2 = std::make_shared<pagemanager>("bstar_import.index", true);
+  bstar<int, BSTAR_ORDER> narrow(pm2);
+  EXPECT_THROW(narrow.import_keys("bstar_raw.image"), std::runtime_error);
+}
+
+TEST_F(DiskBasedBstar, WriteCoalescing) {
+  {
+    pagemanager pm("bstar_batch.index", true);
+    long pages[] = {5, 3, 4, 9, 3};
+    {
+      pagemanager::batch batch(pm);
+      for(long i = 0; i < 5; i++) {
+        long value = 100 * pages[i] + i;
+        pm.save(pages[i], value);
+      }
+      long back = 0;
+      EXPECT_TRUE(pm.recover(3, back));
+      EXPECT_EQ(back, 304);
+      EXPECT_EQ(pm.stats().snap().counters[statistics::WRITE_CALLS], 0u);
+    }
+    // 3, 4, 5 go out with one pwritev, 9 on its own.
+    EXPECT_EQ(pm.stats().snap().counters[statistics::WRITE_CALLS], 2u);
+    EXPECT_EQ(pm.stats().snap().counters[statistics::PAGES_WRITTEN], 5u);
+  }
+  pagemanager pm("bstar_batch.index");
+  long expected[] = {304, 402, 500, 903};
+  long ids[] = {3, 4, 5, 9};
+  for(int i = 0; i < 4; i++) {
+    long back = 0;
+    EXPECT_TRUE(pm.recover(ids[i], back));
+    EXPECT_EQ(back, expected[i]);
+  }
+
+  // Every write to /dev/full fails with ENOSPC; the batch reports it and
+  // keeps its pages.
+  {
+    pagemanager full("/dev/full");
+    long value = 7, back = 0;
+    EXPECT_THROW(full.save(1, value), std::runtime_error);
+    EXPECT_THROW({
+      pagemanager::batch batch(full);
+      full.save(2, value);
+    }, std::runtime_error);
+    EXPECT_TRUE(full.recover(2, back));
+    EXPECT_EQ(back, 7);
+    EXPECT_THROW(full.erase<long>(1), std::runtime_error);
+  }
+
+  // A file size limit makes the batch fail; once it is lifted a direct
+  // write of the same page must win over the copy still staged.
+  {
+    pagemanager pm("bstar_batch.index", true);
+    struct rlimit old;
+    getrlimit(RLIMIT_FSIZE, &old);
+    struct rlimit small = old;
+    small.rlim_cur = 64;
+    auto handler = std::signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &small);
+    long stale = 1, fresh = 2, back = 0;
+    EXPECT_THROW({
+      pagemanager::batch batch(pm);
+      pm.save(20, stale);
+    }, std::runtime_error);
+    setrlimit(RLIMIT_FSIZE, &old);
+    std::signal(SIGXFSZ, handler);
+    pm.save(20, fresh);
+    EXPECT_TRUE(pm.recover(20, back));
+    EXPECT_EQ(back, 2);
+  }
+  {
+    pagemanager pm("bstar_batch.index");
+    long back = 0;
+    EXPECT_TRUE(pm.recover(20, back));
+    EXPECT_EQ(back, 2);
+  }
+
+  std::shared_ptr<pagemanager> tree_pm = std::make_shared<pagemanager>("bstar_batch.index", true);
+  bstar<int, BSTAR_ORDER, true> bt(tree_pm);
+  bt.stats().reset();
+  for(int i = 0; i < 5000; i++) bt.insert((i * 7919) % 5000);
+  for(int i = 0; i < 5000; i += 2) EXPECT_TRUE(bt.remove(i));
+  statistics::snapshot s = bt.stats().snap();
+  EXPECT_LT(s.counters[statistics::WRITE_CALLS], s.counters[statistics::PAGES_WRITTEN]);
+  EXPECT_EQ(bt.size(), 2500);
+  int k = 1;
+  for(auto it = bt.begin(); it != bt.end(); ++it, k += 2) EXPECT_EQ(*it, k);
+  EXPECT_EQ(k, 5001);
+  EXPECT_TRUE(bt.verify(2).ok());
+}
+
+TEST_F(DiskBasedBstar, Crc32cKnownValues) {
+  EXPECT_EQ(crc32c::of("123456789", 9), 0xe3069283u);
+  EXPECT_EQ(crc32c::of("", 0), 0u);
+  std::string text(1000, 'x');
+  for(std::size_t i = 0; i < text.size(); i++) text[i] = char(i * 31);
+  EXPECT_EQ(crc32c::extend(crc32c::of(text.data(), 333), text.data() + 333, 667), crc32c::of(text.data(), 1000));
+}
+
+TEST_F(DiskBasedBstar, LatencyHistogramBuckets) {
+  for(uint64_t v : {0ull, 7ull, 8ull, 15ull, 16ull, 1000ull, 123456789ull, ~0ull}) {
+    int b = statistics::bucket_of(v);
+    EXPECT_LE(statistics::bucket_low(b), v);
+    EXPECT_GE(statistics::bucket_high(b), v);
+  }
+}
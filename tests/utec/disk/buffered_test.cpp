@@ -0,0 +1,101 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <utec/disk/buffered.h>
+
+#include <algorithm>
+#include <csignal>
+#include <set>
+
+#include <sys/resource.h>
+
+struct DiskBufferedBstar : public ::testing::Test
+{
+};
+using namespace utec::disk;
+
+TEST_F(DiskBufferedBstar, MergesMemtableIntoDisk) {
+  std::set<int> expected;
+  {
+    auto pm = std::make_shared<pagemanager>("buffered.index", true);
+    // Room for roughly 200 buffered entries, so the memtable is frozen
+    // and merged many times.
+    buffered_bstar<int, 31> index(pm, 200 * (sizeof(memtable_entry<int>) + sizeof(void *)));
+    for(int i = 0; i < 5000; i++) {
+      int k = (i * 7919) % 5003;
+      index.insert(k);
+      expected.insert(k);
+      EXPECT_LT(index.buffered(), 201u);
+    }
+    for(int k = 0; k < 5003; k += 3) {
+      index.remove(k);
+      expected.erase(k);
+    }
+    // Reinserted after its tombstone reached the disk.
+    index.insert(3);
+    expected.insert(3);
+
+    EXPECT_TRUE(index.contains(3));
+    EXPECT_FALSE(index.contains(6));
+    EXPECT_TRUE(index.contains(7));
+    EXPECT_GT(index.buffered(), 0u);
+
+    std::vector<int> scanned;
+    for(auto it = index.begin(); it != index.end(); ++it) scanned.push_back(*it);
+    EXPECT_EQ(scanned, std::vector<int>(expected.begin(), expected.end()));
+  }
+
+  auto pm = std::make_shared<pagemanager>("buffered.index");
+  buffered_bstar<int, 31> index(pm);
+  EXPECT_EQ(index.buffered(), 0u);
+  std::vector<int> scanned;
+  for(auto it = index.tree().begin(); it != index.tree().end(); ++it) scanned.push_back(*it);
+  EXPECT_EQ(scanned, std::vector<int>(expected.begin(), expected.end()));
+}
+
+TEST_F(DiskBufferedBstar, TombstonesShadowDiskKeys) {
+  auto pm = std::make_shared<pagemanager>("buffered2.index", true);
+  buffered_bstar<int, 7> index(pm);
+  for(int k = 0; k < 100; k++) index.insert(k);
+  index.flush();
+  EXPECT_EQ(index.buffered(), 0u);
+
+  index.remove(10);
+  index.remove(500);
+  index.insert(100);
+  index.insert(10);
+  index.remove(10);
+  EXPECT_EQ(index.buffered(), 3u);
+  EXPECT_FALSE(index.contains(10));
+  EXPECT_TRUE(index.contains(11));
+  EXPECT_TRUE(index.contains(100));
+  EXPECT_TRUE(index.tree().find(10) != index.tree().end());
+
+  std::vector<int> scanned;
+  for(auto it = index.begin(); it != index.end(); ++it) scanned.push_back(*it);
+  EXPECT_EQ(scanned.size(), 100u);
+  EXPECT_EQ(std::count(scanned.begin(), scanned.end(), 10), 0);
+  EXPECT_EQ(scanned.back(), 100);
+
+  index.flush();
+  EXPECT_TRUE(index.tree().find(10) == index.tree().end());
+  EXPECT_FALSE(index.contains(10));
+}
+
+TEST_F(DiskBufferedBstar, DestructorSwallowsFlushErrors) {
+  auto pm = std::make_shared<pagemanager>("buffered3.index", true);
+  struct rlimit old;
+  getrlimit(RLIMIT_FSIZE, &old);
+  auto handler = std::signal(SIGXFSZ, SIG_IGN);
+  {
+    buffered_bstar<int, 7> index(pm);
+    for(int k = 0; k < 1000; k++) index.insert(k);
+    // Page writes now fail; the destructor must not let that escape.
+    struct rlimit small = old;
+    small.rlim_cur = 64;
+    setrlimit(RLIMIT_FSIZE, &small);
+    EXPECT_THROW(index.flush(), std::runtime_error);
+    index.insert(1000);
+  }
+  setrlimit(RLIMIT_FSIZE, &old);
+  std::signal(SIGXFSZ, handler);
+}
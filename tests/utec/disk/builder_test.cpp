@@ -0,0 +1,55 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <utec/disk/builder.h>
+
+#include <fstream>
+
+struct DiskIndexBuilder : public ::testing::Test
+{
+};
+using namespace utec::disk;
+
+TEST_F(DiskIndexBuilder, ExternalSortBuild) {
+  std::vector<long> keys;
+  {
+    std::ofstream out("builder_input.txt");
+    for(long i = 0; i < 50000; i++) {
+      keys.push_back((i * 1000003) % 50021 - 1000);
+      out << keys.back() << (i % 10 == 9 ? "\n" : "  ");
+    }
+  }
+  std::sort(keys.begin(), keys.end());
+
+  indexbuilder<long>::options opt;
+  opt.memory_budget = 64 << 10;
+  opt.chunk_size = 4096;
+  opt.threads = 4;
+  indexbuilder<long> builder(opt);
+
+  std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("builder.index", true);
+  bstar<long, 31, true> bt(pm);
+  EXPECT_EQ(builder.build("builder_input.txt", bt), 50000);
+  EXPECT_GT(builder.spilled(), 8u);
+
+  std::vector<long> scanned;
+  for(auto it = bt.begin(); it != bt.end(); ++it) scanned.push_back(*it);
+  EXPECT_EQ(scanned, keys);
+  EXPECT_EQ(bt.count_range(0, 999), std::upper_bound(keys.begin(), keys.end(), 999) -
+                                    std::lower_bound(keys.begin(), keys.end(), 0));
+  EXPECT_TRUE(bt.find(keys[1234]) != bt.end());
+}
+
+TEST_F(DiskIndexBuilder, SmallInputStaysInMemory) {
+  {
+    std::ofstream out("builder_small.txt");
+    out << "5 3 9\n1\t7";
+  }
+  std::shared_ptr<pagemanager> pm = std::make_shared<pagemanager>("builder_small.index", true);
+  bstar<int, 7> bt(pm);
+  indexbuilder<int> builder;
+  EXPECT_EQ(builder.build("builder_small.txt", bt), 5);
+  EXPECT_EQ(builder.spilled(), 0u);
+  std::vector<int> scanned;
+  for(auto it = bt.begin(); it != bt.end(); ++it) scanned.push_back(*it);
+  EXPECT_EQ(scanned, (std::vector<int>{1, 3, 5, 7, 9}));
+}
@@ -0,0 +1,101 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <utec/disk/bstar.h>
+#include <utec/disk/catalog.h>
+#include <utec/disk/pagemanager.h>
+
+struct DiskCatalog : public ::testing::Test
+{
+};
+using namespace utec::disk;
+
+template <class Tree, class T>
+static std::string contents(Tree &tree, std::vector<T> values) {
+  std::sort(values.begin(), values.end());
+  std::ostringstream out, expected;
+  tree.print(out);
+  for(auto v : values) expected << v;
+  EXPECT_EQ(out.str(), expected.str());
+  return out.str();
+}
+
+TEST_F(DiskCatalog, SharedFile) {
+  std::vector<int> ids, amounts;
+  std::string letters = "zxcnmvfjdaqpirue";
+  {
+    auto pm = std::make_shared<pagemanager>("catalog.index", true, 1024, 64);
+    auto cat = std::make_shared<catalog>(pm);
+    bstar<int, 7> by_id(cat, "orders.id");
+    bstar<int, 31> by_amount(cat, "orders.amount");
+    bstar<char, 7> by_letter(cat, "orders.letter");
+
+    for(int i = 0; i < 3000; i++) {
+      ids.push_back((i * 7919) % 3001);
+      amounts.push_back((i * 104729) % 5003);
+      by_id.insert(ids.back());
+      by_amount.insert(amounts.back());
+    }
+    for(auto c : letters) by_letter.insert(c);
+
+    for(int i = 0; i < 1500; i++) by_id.remove(ids[i]);
+    ids.erase(ids.begin(), ids.begin() + 1500);
+    while(!by_id.reorganize(64));
+
+    contents(by_id, ids);
+    contents(by_amount, amounts);
+    EXPECT_EQ(cat->names().size(), 3u);
+  }
+
+  auto pm = std::make_shared<pagemanager>("catalog.index", false, 1024, 64);
+  auto cat = std::make_shared<catalog>(pm);
+  EXPECT_TRUE(cat->contains("orders.amount"));
+  EXPECT_FALSE(cat->contains("orders.missing"));
+  bstar<int, 7> by_id(cat, "orders.id");
+  bstar<int, 31> by_amount(cat, "orders.amount");
+  bstar<char, 7> by_letter(cat, "orders.letter");
+  contents(by_id, ids);
+  contents(by_amount, amounts);
+  contents(by_letter, std::vector<char>(letters.begin(), letters.end()));
+
+  for(int i = 0; i < 1000; i++) {
+    by_id.insert(10000 + i);
+    ids.push_back(10000 + i);
+  }
+  contents(by_id, ids);
+  EXPECT_GT(pm->stats().snap().counters[statistics::CACHE_HITS], 0u);
+}
+
+TEST_F(DiskCatalog, ManyIndexes) {
+  auto pm = std::make_shared<pagemanager>("catalog_many.index", true, 256);
+  auto cat = std::make_shared<catalog>(pm);
+  for(int i = 0; i < 40; i++) {
+    bstar<int, 7> tree(cat, "idx" + std::to_string(i));
+    for(int k = 0; k < 20; k++) tree.insert(i * 100 + k);
+  }
+
+  auto reopened = std::make_shared<catalog>(pm);
+  EXPECT_EQ(reopened->names().size(), 40u);
+  for(int i = 0; i < 40; i++) {
+    bstar<int, 7> tree(reopened, "idx" + std::to_string(i));
+    std::vector<int> expected;
+    for(int k = 0; k < 20; k++) expected.push_back(i * 100 + k);
+    contents(tree, expected);
+  }
+}
+
+TEST_F(DiskCatalog, RejectsSmallPages) {
+  auto pm = std::make_shared<pagemanager>("catalog_small.index", true, 128);
+  auto cat = std::make_shared<catalog>(pm);
+  typedef bstar<int, 31> wide;
+  EXPECT_THROW(wide(cat, "wide"), std::invalid_argument);
+
+  // At low orders a regular node (5 keys) outgrows the root (2 * F_BLOCK
+  // = 4 keys); a page that only fits the root is refused.
+  typedef utec::packed_key<64> key;
+  typedef bstar<key, 5> narrow;
+  long root_size = sizeof(Node<key, 4, false>);
+  EXPECT_GT((long) sizeof(Node<key, 5, false>), root_size);
+  auto root_pm = std::make_shared<pagemanager>("catalog_small.index", true, root_size);
+  auto root_cat = std::make_shared<catalog>(root_pm);
+  EXPECT_THROW(narrow(root_cat, "narrow"), std::invalid_argument);
+}
@@ -0,0 +1,97 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <utec/disk/ioengine.h>
+#include <utec/disk/pagemanager.h>
+
+struct DiskIoEngine : public ::testing::Test
+{
+};
+using namespace utec::disk;
+
+struct page {
+  long id;
+  char payload[120];
+};
+
+static void check_reads(bool use_uring) {
+  pagemanager pm("ioengine.index", true);
+  for(long i = 0; i < 256; i++) {
+    page p{};
+    p.id = i;
+    std::fill(p.payload, p.payload + sizeof(p.payload), (char)('a' + i % 26));
+    pm.save(i, p);
+  }
+
+  int fd = ::open("ioengine.index", O_RDONLY);
+  ioengine io(fd, 16, 3, use_uring);
+  std::vector<page> pages(256);
+  std::vector<ioengine::ticket> tickets;
+  for(long i = 255; i >= 0; i--) {
+    tickets.push_back(io.submit(i * sizeof(page), &pages[i], sizeof(page)));
+  }
+  for(auto t : tickets) {
+    EXPECT_EQ(io.wait(t), (long)sizeof(page));
+  }
+  for(long i = 0; i < 256; i++) {
+    EXPECT_EQ(pages[i].id, i);
+    EXPECT_EQ(pages[i].payload[119], (char)('a' + i % 26));
+  }
+
+  page past;
+  EXPECT_EQ(io.wait(io.submit(300 * sizeof(page), &past, sizeof(page))), 0);
+  ::close(fd);
+}
+
+TEST_F(DiskIoEngine, ThreadPoolReads) {
+  check_reads(false);
+}
+
+TEST_F(DiskIoEngine, DefaultEngineReads) {
+  check_reads(true);
+}
+
+TEST_F(DiskIoEngine, PageManagerAsyncRecover) {
+  pagemanager pm("ioengine.index", true);
+  for(long i = 0; i < 8; i++) {
+    page p{};
+    p.id = i * 10;
+    pm.save(i, p);
+  }
+  page a, b;
+  auto ta = pm.recover_async(3, a);
+  auto tb = pm.recover_async(5, b);
+  EXPECT_TRUE(pm.wait(tb));
+  EXPECT_TRUE(pm.wait(ta));
+  EXPECT_EQ(a.id, 30);
+  EXPECT_EQ(b.id, 50);
+}
+
+TEST_F(DiskIoEngine, ConcurrentWaiters) {
+  pagemanager pm("ioengine.index", true);
+  for(long i = 0; i < 64; i++) {
+    page p{};
+    p.id = i;
+    pm.save(i, p);
+  }
+  int fd = ::open("ioengine.index", O_RDONLY);
+  for(bool use_uring : {false, true}) {
+    ioengine io(fd, 8, 2, use_uring);
+    std::vector<std::thread> threads;
+    std::vector<int> wrong(4, 0);
+    for(int t = 0; t < 4; t++) {
+      threads.emplace_back([&, t] {
+        for(long i = 0; i < 500; i++) {
+          long id = (i * 7 + t) % 64;
+          page p[2];
+          auto a = io.submit(id * sizeof(page), &p[0], sizeof(page));
+          auto b = io.submit((63 - id) * sizeof(page), &p[1], sizeof(page));
+          if(io.wait(b) != (long)sizeof(page) || p[1].id != 63 - id) wrong[t]++;
+          if(io.wait(a) != (long)sizeof(page) || p[0].id != id) wrong[t]++;
+        }
+      });
+    }
+    for(auto &t : threads) t.join();
+    EXPECT_EQ(wrong, std::vector<int>(4, 0));
+  }
+  ::close(fd);
+}
@@ -0,0 +1,88 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <utec/disk/multimap.h>
+
+struct DiskMultimap : public ::testing::Test
+{
+};
+using namespace utec::disk;
+
+TEST_F(DiskMultimap, PostingLists) {
+  std::map<int, std::set<long>> expected;
+  {
+    auto pm = std::make_shared<pagemanager>("multimap.index", true, 8192, 32);
+    auto cat = std::make_shared<catalog>(pm);
+    multimap<int, 15> by_status(cat, "orders.status");
+
+    for(long row = 0; row < 20000; row++) {
+      int status = (row * 7919) % 5;
+      long id = (row * 104729) % 20011;
+      EXPECT_EQ(by_status.insert(status, id), expected[status].insert(id).second);
+    }
+    EXPECT_FALSE(by_status.insert(0, *expected[0].begin()));
+    by_status.insert(9, 42);
+    expected[9].insert(42);
+
+    for(auto id : std::vector<long>(expected[3].begin(), expected[3].end())) {
+      if(id % 3) {
+        EXPECT_TRUE(by_status.remove(3, id));
+        expected[3].erase(id);
+      }
+    }
+    EXPECT_FALSE(by_status.remove(3, 1));
+    EXPECT_TRUE(by_status.remove(4));
+    expected.erase(4);
+  }
+
+  auto pm = std::make_shared<pagemanager>("multimap.index", false, 8192, 32);
+  auto cat = std::make_shared<catalog>(pm);
+  multimap<int, 15> by_status(cat, "orders.status");
+  for(auto &kv : expected) {
+    EXPECT_EQ(by_status.count(kv.first), (long)kv.second.size());
+    std::vector<long> rows = by_status.rows(kv.first);
+    EXPECT_EQ(rows, std::vector<long>(kv.second.begin(), kv.second.end()));
+  }
+  EXPECT_EQ(by_status.count(4), 0);
+  EXPECT_TRUE(by_status.rows(4).empty());
+
+  for(auto id : std::vector<long>(expected[9].begin(), expected[9].end())) by_status.remove(9, id);
+  EXPECT_EQ(by_status.count(9), 0);
+}
+
+TEST_F(DiskMultimap, SpillsAndReturnsInline) {
+  auto pm = std::make_shared<pagemanager>("multimap_inline.index", true, 2048);
+  auto cat = std::make_shared<catalog>(pm);
+  multimap<long, 7, 4> index(cat, "idx");
+  for(long row = 0; row < 1000; row++) index.insert(7, row * 1000003);
+  EXPECT_EQ(index.count(7), 1000);
+  for(long row = 2; row < 1000; row++) index.remove(7, row * 1000003);
+  EXPECT_EQ(index.rows(7), (std::vector<long>{0, 1000003}));
+  index.insert(7, 5);
+  EXPECT_EQ(index.rows(7), (std::vector<long>{0, 5, 1000003}));
+}
+
+TEST_F(DiskMultimap, HashIndexMatchesOnKey) {
+  auto pm = std::make_shared<pagemanager>("multimap_hash.index", true, 2048);
+  auto cat = std::make_shared<catalog>(pm);
+  multimap<int, 7, 4> index(cat, "idx");
+  for(long row = 0; row < 2000; row++) index.insert(row % 200, row);
+  index.index().enable_hash_index(64);
+  pm->stats().reset();
+  for(int round = 0; round < 20; round++) {
+    for(int key = 0; key < 10; key++) EXPECT_EQ(index.count(key), 10);
+  }
+  EXPECT_GT(pm->stats().snap().counters[statistics::HASH_HITS], 100u);
+
+  // Probes equal on the key hit whatever their other fields hold.
+  pm->stats().reset();
+  for(int round = 0; round < 20; round++) {
+    multimap<int, 7, 4>::entry probe{}, out;
+    probe.key = 150;
+    probe.count = round;
+    EXPECT_TRUE(index.index().lookup(probe, out));
+    EXPECT_EQ(out.count, 10);
+  }
+  EXPECT_GT(pm->stats().snap().counters[statistics::HASH_HITS], 15u);
+  index.insert(3, 5000);
+  EXPECT_EQ(index.count(3), 11);
+}
@@ -0,0 +1,80 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <utec/disk/sharded.h>
+
+#include <cstdio>
+
+struct DiskShardedBstar : public ::testing::Test
+{
+};
+using namespace utec::disk;
+
+TEST_F(DiskShardedBstar, RoutesAndScansInOrder) {
+  std::remove("sharded.shards");
+  std::vector<int> keys;
+  for(int i = 0; i < 4000; i++) keys.push_back((i * 7919) % 4001);
+  {
+    sharded_bstar<int, 31> index("sharded", {1000, 2000, 3000});
+    EXPECT_EQ(index.size(), 4u);
+    index.insert_batch(keys, 4);
+    for(int k : {0, 999, 1000, 2500, 3999}) EXPECT_TRUE(index.contains(k));
+    for(int k = 0; k <= 4000; k += 2) EXPECT_TRUE(index.remove(k));
+    EXPECT_FALSE(index.remove(0));
+
+    std::vector<long> load = index.load();
+    EXPECT_EQ(load.size(), 4u);
+    EXPECT_GT(load[0], 0);
+  }
+
+  std::sort(keys.begin(), keys.end());
+  std::vector<int> expected;
+  for(int k : keys) if(k % 2) expected.push_back(k);
+
+  sharded_bstar<int, 31> index("sharded");
+  EXPECT_EQ(index.boundaries(), (std::vector<int>{1000, 2000, 3000}));
+  std::vector<int> scanned;
+  for(auto it = index.begin(); it != index.end(); ++it) scanned.push_back(*it);
+  EXPECT_EQ(scanned, expected);
+  EXPECT_TRUE(index.find(1001) != index.end());
+  EXPECT_TRUE(index.find(1002) == index.end());
+}
+
+TEST_F(DiskShardedBstar, SplitsHotShard) {
+  std::remove("sharded_split.shards");
+  sharded_bstar<int, 31> index("sharded_split", {100});
+  for(int i = 0; i < 2000; i++) index.insert(100 + (i * 7919) % 2000);
+  index.insert(5);
+  EXPECT_EQ(index.hottest(), 1u);
+
+  EXPECT_TRUE(index.split(1));
+  EXPECT_EQ(index.size(), 3u);
+  EXPECT_EQ(index.boundaries().size(), 2u);
+  EXPECT_EQ(index.boundaries()[1], 1100);
+  EXPECT_EQ(index.shard_of(1100), 2u);
+
+  std::vector<int> scanned;
+  for(auto it = index.begin(); it != index.end(); ++it) scanned.push_back(*it);
+  EXPECT_EQ(scanned.size(), 2001u);
+  EXPECT_TRUE(std::is_sorted(scanned.begin(), scanned.end()));
+  EXPECT_TRUE(index.contains(1500));
+  EXPECT_TRUE(index.tree(1).find(1500) == index.tree(1).end());
+}
+
+TEST_F(DiskShardedBstar, ReopenDropsKeysLeftByCutSplit) {
+  std::remove("sharded_cut.shards");
+  {
+    sharded_bstar<int, 31> index("sharded_cut", {100});
+    for(int i = 0; i < 1000; i++) index.insert(100 + i);
+    EXPECT_TRUE(index.split(1));
+    // What a crash after saving the layout leaves: the moved keys are
+    // still in the old shard as well.
+    for(int k = 600; k < 1100; k++) index.tree(1).insert(k);
+  }
+  sharded_bstar<int, 31> index("sharded_cut");
+  EXPECT_EQ(index.size(), 3u);
+  std::vector<int> scanned, expected;
+  for(auto it = index.begin(); it != index.end(); ++it) scanned.push_back(*it);
+  for(int i = 0; i < 1000; i++) expected.push_back(100 + i);
+  EXPECT_EQ(scanned, expected);
+  EXPECT_TRUE(index.tree(1).lower_bound(600) == index.tree(1).end());
+}
@@ -1,12 +1,58 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <utec/memory/bstar.h>
+#include <utec/setops.h>
 #include <fmt/core.h>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
 
 struct MemoryBasedBtree : public ::testing::Test
 {
 };
 
+// Allocator that counts the allocations made through it.
+template <class C>
+struct counting_allocator {
+    typedef C value_type;
+    static long allocations;
+
+    counting_allocator() {}
+    template <class U> counting_allocator(const counting_allocator<U> &) {}
+
+    C *allocate(std::size_t n) {
+        allocations++;
+        return std::allocator<C>().allocate(n);
+    }
+    void deallocate(C *p, std::size_t n) { std::allocator<C>().deallocate(p, n); }
+};
+
+template <class C> long counting_allocator<C>::allocations = 0;
+
+template <class C, class U>
+bool operator==(const counting_allocator<C> &, const counting_allocator<U> &) { return true; }
+template <class C, class U>
+bool operator!=(const counting_allocator<C> &, const counting_allocator<U> &) { return false; }
+
+// String key whose text is allocated through counting_allocator, so the
+// tree's copies of it show up as allocations.
+struct counted_key {
+    typedef std::basic_string<char, std::char_traits<char>, counting_allocator<char>> string;
+    string text;
+
+    counted_key(const std::string &text) : text(text.data(), text.size()) {}
+
+    static long allocations() { return counting_allocator<char>::allocations; }
+};
+
+bool operator<(const counted_key &a, const counted_key &b) { return a.text < b.text; }
+bool operator<=(const counted_key &a, const counted_key &b) { return a.text <= b.text; }
+bool operator<(const counted_key &a, const char *b) { return a.text < b; }
+bool operator<(const char *a, const counted_key &b) { return a < b.text; }
+
 TEST_F(MemoryBasedBtree, TestA) {
     using namespace utec::memory;
     
@@ -20,3 +66,234 @@ TEST_F(MemoryBasedBtree, TestA) {
 }
  
  
+
+TEST_F(MemoryBasedBtree, OrderStatistics) {
+    using namespace utec::memory;
+
+    bstar<int, 7, true> bt;
+    std::vector<int> keys;
+    for(int i = 0; i < 3000; i++) {
+        int k = (i * 7919) % 3001;
+        bt.insert(k);
+        keys.push_back(k);
+    }
+    for(int i = 0; i < 1500; i++) {
+        int k = (i * 104729) % 3001;
+        auto it = std::find(keys.begin(), keys.end(), k);
+        EXPECT_EQ(bt.remove(k), it != keys.end());
+        if(it != keys.end()) keys.erase(it);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    EXPECT_EQ(bt.size(), (long) keys.size());
+    for(int k = -1; k <= 3001; k += 7) {
+        EXPECT_EQ(bt.rank(k), std::lower_bound(keys.begin(), keys.end(), k) - keys.begin());
+    }
+    for(long i = 0; i < (long) keys.size(); i += 13) {
+        int out;
+        EXPECT_TRUE(bt.select(i, out));
+        EXPECT_EQ(out, keys[i]);
+    }
+    EXPECT_EQ(bt.count_range(100, 199),
+              std::upper_bound(keys.begin(), keys.end(), 199) - std::lower_bound(keys.begin(), keys.end(), 100));
+}
+
+TEST_F(MemoryBasedBtree, SaveAndLoad) {
+    using namespace utec::memory;
+
+    std::set<int> expected;
+    {
+        bstar<int> bt;
+        for(int i = 0; i < 20000; i++) {
+            int k = (i * 7919) % 20011;
+            bt.insert(k);
+            expected.insert(k);
+        }
+        bt.save("memory_bstar.image");
+    }
+
+    bstar<int, 7, true> loaded;
+    loaded.insert(-5);
+    loaded.load("memory_bstar.image");
+    EXPECT_EQ(loaded.size(), (long) expected.size());
+    std::vector<int> keys;
+    loaded.for_each([&keys](int k) { keys.push_back(k); });
+    EXPECT_TRUE(std::equal(keys.begin(), keys.end(), expected.begin()) && keys.size() == expected.size());
+
+    // The rebuilt tree keeps working under further writes.
+    for(int i = 0; i < 20000; i += 3) {
+        int k = (i * 104729) % 20011;
+        EXPECT_EQ(loaded.remove(k), expected.erase(k) == 1);
+        loaded.insert(k + 30000);
+        expected.insert(k + 30000);
+    }
+    keys.clear();
+    loaded.for_each([&keys](int k) { keys.push_back(k); });
+    EXPECT_TRUE(std::equal(keys.begin(), keys.end(), expected.begin()) && keys.size() == expected.size());
+    EXPECT_EQ(loaded.rank(15000), std::distance(expected.begin(), expected.lower_bound(15000)));
+
+    bstar<long> wrong;
+    EXPECT_THROW(wrong.load("memory_bstar.image"), std::runtime_error);
+    EXPECT_THROW(wrong.load("missing.image"), std::runtime_error);
+
+    bstar<int> empty, reloaded;
+    empty.save("memory_bstar.image");
+    reloaded.insert(3);
+    reloaded.load("memory_bstar.image");
+    EXPECT_FALSE(reloaded.search(3));
+    reloaded.insert(4);
+    EXPECT_TRUE(reloaded.search(4));
+    std::remove("memory_bstar.image");
+}
+
+TEST_F(MemoryBasedBtree, IteratorsAndRanges) {
+    using namespace utec::memory;
+
+    bstar<int, 5> bt;
+    EXPECT_TRUE(bt.begin() == bt.end());
+    std::multiset<int> expected;
+    for(int i = 0; i < 5000; i++) {
+        int k = (i * 7919) % 2003;
+        bt.insert(k);
+        expected.insert(k);
+    }
+
+    EXPECT_TRUE(std::equal(bt.begin(), bt.end(), expected.begin()));
+    EXPECT_EQ(std::distance(bt.begin(), bt.end()), (long) expected.size());
+    std::vector<int> backwards(expected.rbegin(), expected.rend());
+    auto it = bt.end();
+    for(int k : backwards) EXPECT_EQ(*--it, k);
+    EXPECT_TRUE(it == bt.begin());
+
+    for(int k = -3; k <= 2010; k += 5) {
+        auto lb = bt.lower_bound(k);
+        auto ub = bt.upper_bound(k);
+        EXPECT_EQ(std::distance(bt.begin(), lb), std::distance(expected.begin(), expected.lower_bound(k)));
+        EXPECT_EQ(std::distance(bt.begin(), ub), std::distance(expected.begin(), expected.upper_bound(k)));
+        auto range = bt.equal_range(k);
+        EXPECT_EQ(std::distance(range.first, range.second), (long) expected.count(k));
+    }
+    EXPECT_EQ(*std::prev(bt.end()), 2002);
+
+    std::vector<int> seen;
+    bt.for_each_in_range(100, 350, [&seen](int k) { seen.push_back(k); });
+    EXPECT_TRUE(std::equal(seen.begin(), seen.end(), expected.lower_bound(100)));
+    EXPECT_EQ(seen.size(), (std::size_t) std::distance(expected.lower_bound(100), expected.upper_bound(350)));
+    seen.clear();
+    bt.for_each_in_range(350, 100, [&seen](int k) { seen.push_back(k); });
+    EXPECT_TRUE(seen.empty());
+}
+
+TEST_F(MemoryBasedBtree, KeysAreMovedNotCopied) {
+    using namespace utec::memory;
+
+    bstar<counted_key, 5> bt;
+    std::vector<std::string> texts;
+    for(int i = 0; i < 3000; i++) texts.push_back(fmt::format("a key long enough to allocate {:05}", (i * 7919) % 3001));
+    // One allocation per key built, none by the tree.
+    long before = counted_key::allocations();
+    for(int i = 0; i < 3000; i += 2) bt.insert(counted_key(texts[i]));
+    for(int i = 1; i < 3000; i += 2) bt.emplace(texts[i]);
+    EXPECT_EQ(counted_key::allocations() - before, 3000);
+
+    // Lookups by a plain C string never build a counted_key.
+    before = counted_key::allocations();
+    for(int i = 0; i < 3000; i += 7) {
+        EXPECT_TRUE(bt.search(texts[i].c_str()));
+        EXPECT_STREQ(bt.lower_bound(texts[i].c_str())->text.c_str(), texts[i].c_str());
+    }
+    EXPECT_FALSE(bt.search("a key long enough to allocate 99999"));
+    EXPECT_EQ(counted_key::allocations(), before);
+
+    for(int i = 0; i < 3000; i += 3) EXPECT_TRUE(bt.remove(texts[i].c_str()));
+    EXPECT_FALSE(bt.remove(texts[0].c_str()));
+    EXPECT_EQ(counted_key::allocations(), before);
+
+    counted_key out("");
+    before = counted_key::allocations();
+    EXPECT_TRUE(bt.lookup(texts[1].c_str(), out));
+    EXPECT_EQ(counted_key::allocations() - before, 1);
+    bt.insert(out);
+    EXPECT_EQ(counted_key::allocations() - before, 2);
+    EXPECT_EQ(std::distance(bt.begin(), bt.end()), 2001);
+}
+
+TEST_F(MemoryBasedBtree, EncodedKeysKeepTupleOrder) {
+    using namespace utec::memory;
+
+    bstar<std::string, 7> bt;
+    std::set<std::tuple<long, std::string, unsigned char>> expected;
+    std::vector<std::string> texts = {"", "a", std::string("a\0b", 3), std::string("a\0", 2), "ab", "b", "\xff"};
+    for(long n : {-(1L << 40), -2L, -1L, 0L, 1L, 255L, 256L, 1L << 40}) {
+        for(auto &text : texts) {
+            for(unsigned char c : {0, 1, 254, 255}) {
+                bt.insert(utec::encode_key(n, text, c));
+                expected.insert(std::make_tuple(n, text, c));
+            }
+        }
+    }
+
+    auto want = expected.begin();
+    for(auto it = bt.begin(); it != bt.end(); ++it, ++want) {
+        utec::key_decoder columns(*it);
+        long n = columns.get<long>();
+        std::string text = columns.get_string();
+        unsigned char c = columns.get<unsigned char>();
+        EXPECT_EQ(columns.left(), 0u);
+        EXPECT_EQ(std::make_tuple(n, text, c), *want);
+    }
+    EXPECT_TRUE(want == expected.end());
+
+    bstar<int, 5, false, std::greater<int>> reversed;
+    for(int i = 0; i < 100; i++) reversed.insert(i);
+    EXPECT_EQ(*reversed.begin(), 99);
+    EXPECT_EQ(*reversed.lower_bound(50), 50);
+    EXPECT_EQ(*reversed.upper_bound(50), 49);
+}
+
+TEST_F(MemoryBasedBtree, SetOperations) {
+    using namespace utec::memory;
+
+    bstar<int, 5> a, b;
+    std::vector<int> as, bs;
+    for(int i = 0; i < 4000; i++) {
+        int k = (i * 7919) % 3001;
+        a.insert(k);
+        as.push_back(k);
+        if(i % 3 == 0) {
+            b.insert(k / 2);
+            bs.push_back(k / 2);
+        }
+    }
+    std::sort(as.begin(), as.end());
+    std::sort(bs.begin(), bs.end());
+
+    std::vector<int> got, want;
+    utec::intersect(a, b, [&got](int k) { got.push_back(k); });
+    std::set_intersection(as.begin(), as.end(), bs.begin(), bs.end(), std::back_inserter(want));
+    EXPECT_EQ(got, want);
+
+    got.clear();
+    want.clear();
+    utec::unite(a, b, [&got](int k) { got.push_back(k); });
+    std::set_union(as.begin(), as.end(), bs.begin(), bs.end(), std::back_inserter(want));
+    EXPECT_EQ(got, want);
+
+    got.clear();
+    want.clear();
+    utec::difference(a, b, [&got](int k) { got.push_back(k); });
+    std::set_difference(as.begin(), as.end(), bs.begin(), bs.end(), std::back_inserter(want));
+    EXPECT_EQ(got, want);
+
+    bstar<int, 5, true> result;
+    result.bulk_load(got);
+    EXPECT_EQ(result.size(), (long) got.size());
+    EXPECT_TRUE(std::equal(result.begin(), result.end(), got.begin()));
+
+    for(int k = -1; k < 3010; k += 11) {
+        auto it = a.begin();
+        it.advance_to(k / 2);
+        it.advance_to(k);
+        EXPECT_EQ(std::distance(a.begin(), it), std::lower_bound(as.begin(), as.end(), k) - as.begin());
+    }
+}